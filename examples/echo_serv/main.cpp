@@ -1,100 +1,132 @@
 #include <iostream>
 #include <string>
-#include <algorithm>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstring>
 
 #include <socks/socks.hpp>
+#include <socks/serverRuntime.hpp>
 
-int main()
+int main(int argc, char** argv)
 {
-    std::string motd = "Echo Serv Telnet Example\r\n";
-    std::vector<uint8_t> motd_message = std::vector<uint8_t>(motd.begin(), motd.end());
-    // Create the master socket, handles all incoming connections
-    sks::socket master_socket = sks::socket(sks::IPv4, sks::stream);
-    // Generate the address parameters for the master socket
-    sks::address host = sks::address("localhost:8888");
-
-    // Attempt to bind the address parameter to the master socket, catch if it fails
-    try {
-        master_socket.bind(host);
-    }
-    catch (std::exception& e) {
-        std::cerr << "Bind Error:\n" << e.what() << std::endl;
-    }
-
-
-    std::cout << "Listener on address " << master_socket.localAddress().name() << std::endl;
-
-    // Try to specify maximum of 3 pending connections for the master socket
-    try {
-        master_socket.listen(3);
-    }
-    catch (std::exception& e) {
-        std::cerr << "Listen failure:\n" << e.what() << std::endl;
+    // --verbose prints connections and messages, --broadcast sends each message to every other client instead of back to its sender
+    // Neither is on by default, so the data path (the benchmarked part) takes no shared lock and allocates nothing
+    bool verbose = false;
+    bool broadcast = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = true;
+        }
+        else if (strcmp(argv[i], "--broadcast") == 0)
+        {
+            broadcast = true;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--verbose] [--broadcast]" << std::endl;
+            return 1;
+        }
     }
 
-    std::cout << "Waiting for connections..." << std::endl;
+    std::string motd = "Echo Serv Telnet Example\r\n";
+    std::vector<uint8_t> motd_message = std::vector<uint8_t>(motd.begin(), motd.end());
 
-    std::vector<sks::socket> clientList;
+    // Workers print from their own threads, keep their lines whole
+    std::mutex print_lock;
 
-    while (true)
+    // Each worker thread accepts and serves its own clients; these handlers are called on the thread owning the client
+    sks::serverHandlers handlers;
+    handlers.onOpen = [&](sks::connection& client)
     {
-        // Try to check for new socket connection, and add it to the clientList vector
-        try {
-            // Is master socket ready to receive a new client socket?
-            if (master_socket.readReady())
-            {
-                // Push new client socket to the back of the clientList vector
-                clientList.push_back(master_socket.accept());
-
-                // Get a reference to the last client in the clientList (which will be the last one pushed back)
-                sks::socket& lastConnectedClient = clientList.back();
-                // Convert to sks::IPv4Address so we can easily pull the IP and Port
-                sks::IPv4Address info = (sks::IPv4Address)lastConnectedClient.connectedAddress();
-
-                // Yes, it's ugly.
-                std::cout << "New client connect. IP is "
-                          << info.addr()[0] << "." << info.addr()[1] << "." << info.addr()[2] << "." << info.addr()[3]
-                          << ", Port is " << info.port()
-                          << std::endl;
-
-                // Send the motd as a vector of bytes (uint8_t)
-                lastConnectedClient.send(motd_message);
-            }
-        }
-        catch (std::exception& e) {
-            std::cerr << "Reading data on master_socket FAILED:\n" << e.what() << std::endl;
+        if (verbose)
+        {
+            // Convert to sks::IPv4Address so we can easily pull the IP and Port
+            // The peer address was recorded while accepting, so this costs no extra system call
+            sks::IPv4Address info = (sks::IPv4Address)client.peer();
+            std::lock_guard<std::mutex> guard(print_lock);
+            // Yes, it's ugly.
+            std::cout << "New client connect. IP is "
+                      << (int)info.addr()[0] << "." << (int)info.addr()[1] << "." << (int)info.addr()[2] << "." << (int)info.addr()[3]
+                      << ", Port is " << info.port()
+                      << " (worker " << client.worker().index() << ")"
+                      << std::endl;
         }
 
-        for (auto& l : clientList)
+        // Send the motd as a vector of bytes (uint8_t)
+        client.send(motd_message);
+    };
+    handlers.onData = [&](sks::connection& client, const uint8_t* data, size_t len)
+    {
+        if (verbose)
         {
-            try {
-                if (l.readReady())
-                {
-                    std::string cIP = l.connectedAddress().name();
-                    std::vector<uint8_t> bytes = l.receive();
+            char cIP[sks::address::maxNameLength];
+            client.peer().formatTo(cIP, sizeof(cIP));
+            std::lock_guard<std::mutex> guard(print_lock);
+            std::cout << cIP << "> " << std::string(data, data + len) << std::endl;
+        }
 
-                    if (bytes.empty())
-                    {
-                        std::cout << cIP << " has disconnected" << std::endl;
-                        clientList.erase(std::remove(clientList.begin(), clientList.end(), l), clientList.end());
-                        continue;
-                    }
+        if (!broadcast)
+        {
+            // Echo straight back, on the worker's own thread
+            client.send(data, len);
+            return;
+        }
 
-                    std::cout << cIP << "> " << std::string(bytes.begin(), bytes.end()) << std::endl;
-                    for (auto& cl : clientList)
-                    {
-                        if (l != cl)
-                        {
-                            cl.send(bytes);
-                        }
-                    }
-                }
+        // Clients of this worker are sent to directly
+        uint64_t sender = client.id();
+        client.worker().forEach([&](sks::connection& other)
+        {
+            if (other.id() != sender)
+            {
+                other.send(data, len);
             }
-            catch (std::exception& e)
+        });
+        // Other clients belong to other workers, so the message is handed to each of them to send to its own clients
+        sks::serverRuntime& runtime = client.worker().runtime();
+        if (runtime.size() == 1)
+        {
+            return;
+        }
+        std::shared_ptr<std::vector<uint8_t>> bytes = std::make_shared<std::vector<uint8_t>>(data, data + len);
+        for (size_t w = 0; w < runtime.size(); w++)
+        {
+            if (w == client.worker().index())
             {
-                std::cerr << "Echo error:\n" << e.what() << std::endl;
+                continue;
             }
+            runtime.post(w, [bytes](sks::serverWorker& worker)
+            {
+                worker.forEach([&](sks::connection& other)
+                {
+                    other.send(*bytes);
+                });
+            });
+        }
+    };
+    handlers.onClose = [&](sks::connection& client)
+    {
+        if (verbose)
+        {
+            char cIP[sks::address::maxNameLength];
+            client.peer().formatTo(cIP, sizeof(cIP));
+            std::lock_guard<std::mutex> guard(print_lock);
+            std::cout << cIP << " has disconnected" << std::endl;
         }
+    };
+
+    // One listener (SO_REUSEPORT) and one pinned worker thread per core
+    try {
+        sks::serverRuntime runtime(sks::address("localhost:8888"), handlers);
+        std::cout << "Listener on address " << runtime.localAddress().name() << " with " << runtime.size() << " workers" << std::endl;
+        std::cout << "Waiting for connections..." << std::endl;
+        runtime.run();
+    }
+    catch (std::exception& e) {
+        std::cerr << "Server failure:\n" << e.what() << std::endl;
+        return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
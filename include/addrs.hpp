@@ -46,6 +46,7 @@ namespace sks {
 	};
 
 	class addressBase;
+	class resolver;
 	class IPv4Address;
 	class IPv6Address;
 	class unixAddress;
@@ -53,31 +54,23 @@ namespace sks {
 	class ax25Address;
 	#endif
 
-	//generic address class	
+	//generic address class
+	//The system representation is held inline, so constructing, copying and comparing never allocates
 	class address {
 	protected:
-		domain m_domain; //Domain of this address (each domain should have its own, specific, child-class)
-		union {
-			IPv4Address* IPv4;
-			IPv6Address* IPv6;
-			unixAddress* unix;
-			#ifdef __SKS_HAS_AX25__
-			ax25Address* ax25;
-			#endif
-			addressBase* base = nullptr;
-		} m_addresses;
+		sockaddr_storage m_storage; //Only the first m_size bytes are meaningful
+		socklen_t m_size = 0; //0 for a blank (default-constructed) address
+		domain m_domain = (domain)0xFF; //Domain of this address (each domain should have its own, specific, child-class)
 	public:
 		address();
 		address(const std::string& addrstr, domain d = (domain)0);
+		address(const std::string& addrstr, resolver& r, domain d = (domain)0); //Hostnames are looked up through r (and its cache)
 		address(const sockaddr_storage& from, socklen_t len);
 		address(const addressBase& addr); //Construct from any specific sub-type OR similar type
-		address(const address& addr);
-		address(address&& addr);
-		~address();
-
-		address& operator=(const address& addr);
-		address& operator=(address&& addr);
 		void assign(const sockaddr_storage& from, socklen_t len);
+		//Parse numeric IPv4/IPv6 forms (a.b.c.d[:port], f::f, [f::f][:port]) only; never resolves or throws
+		//Returns false, leaving to untouched, if addrstr is not one of them
+		static bool parseNumeric(const std::string& addrstr, address& to, domain d = (domain)0);
 
 		operator sockaddr_storage() const;
 		socklen_t size() const;
@@ -94,6 +87,10 @@ namespace sks {
 		
 		domain addressDomain() const;
 		std::string name() const;
+		//Write name() into buf (null-terminated, truncated to fit) without allocating
+		//Returns the length of the full name, so a result >= bufSize means it was truncated
+		size_t formatTo(char* buf, size_t bufSize) const;
+		static const size_t maxNameLength = 128; //Buffer size which fits any name (including the null terminator)
 	};
 
 	//address base-class/interface
@@ -114,6 +111,8 @@ namespace sks {
 		//This string should be usable to construct an identical address
 		//Must be implemented by child classes
 		virtual std::string name() const = 0;
+		//Same as name(), written into buf (see address::formatTo(...))
+		virtual size_t formatTo(char* buf, size_t bufSize) const = 0;
 	};
 	//bool createAddress(const std::string addrstr, addressBase& to); //(try to) create an address based on string alone
 	//void createAddress(const sockaddr_storage from, const socklen_t len, addressBase& to); //Convert sockaddr to address
@@ -124,7 +123,6 @@ namespace sks {
 	protected:
 		std::array<uint8_t, 4> m_addr; //32-bit address
 		uint16_t m_port = 0;
-		std::string m_name;
 	public:
 		IPv4Address(uint16_t port = 0); //Construct an any address
 		IPv4Address(const std::string& addrstr); //Parse address from string
@@ -139,7 +137,8 @@ namespace sks {
 	
 		std::array<uint8_t, 4> addr() const;
 		uint16_t port() const;
-		std::string name() const override;
+		std::string name() const override; //Numeric, a.b.c.d:port
+		size_t formatTo(char* buf, size_t bufSize) const override;
 	};
 	
 	class IPv6Address : public addressBase {
@@ -148,7 +147,6 @@ namespace sks {
 		uint16_t m_port = 0;
 		uint32_t m_flowInfo = 0;
 		uint32_t m_scopeId = 0;
-		std::string m_name;
 	public:
 		IPv6Address(uint16_t port = 0); //Construct an any address
 		IPv6Address(const std::string& addrstr); //Parse address from string
@@ -168,7 +166,8 @@ namespace sks {
 		uint16_t port() const;
 		uint32_t flowInfo() const;
 		uint32_t scopeId() const;
-		std::string name() const override;
+		std::string name() const override; //Numeric, [a:b::c]:port
+		size_t formatTo(char* buf, size_t bufSize) const override;
 	};
 	
 	class unixAddress : public addressBase {
@@ -189,6 +188,7 @@ namespace sks {
 		bool operator<(const unixAddress& r) const;
 		
 		std::string name() const override;
+		size_t formatTo(char* buf, size_t bufSize) const override;
 		bool named() const;
 	};
 	
@@ -215,6 +215,7 @@ namespace sks {
 		std::string callsign() const;
 		uint8_t ssid() const;
 		std::string name() const override;
+		size_t formatTo(char* buf, size_t bufSize) const override;
 	};
 	#endif
 };
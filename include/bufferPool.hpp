@@ -0,0 +1,98 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+namespace sks {
+	class bufferPool;
+
+	//Move-only handle to a buffer from a bufferPool, returned to the pool on destruction
+	//Acts like a fixed-capacity std::vector<uint8_t> whose contents are not initialized
+	class pooledBuffer {
+	protected:
+		uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+		size_t m_capacity = 0;
+		bufferPool* m_pool = nullptr;
+		uint8_t m_sizeClass = 0;
+
+		friend class bufferPool;
+		pooledBuffer(uint8_t* data, size_t size, size_t capacity, bufferPool* pool, uint8_t sizeClass);
+	public:
+		pooledBuffer();
+		pooledBuffer(const pooledBuffer&) = delete;
+		pooledBuffer(pooledBuffer&& r);
+		~pooledBuffer();
+
+		pooledBuffer& operator=(const pooledBuffer&) = delete;
+		pooledBuffer& operator=(pooledBuffer&& r);
+
+		uint8_t* data();
+		const uint8_t* data() const;
+		size_t size() const;
+		size_t capacity() const;
+		bool empty() const;
+		void resize(size_t size); //Up to capacity(), throws std::length_error otherwise
+
+		uint8_t& operator[](size_t index);
+		const uint8_t& operator[](size_t index) const;
+		uint8_t* begin();
+		uint8_t* end();
+		const uint8_t* begin() const;
+		const uint8_t* end() const;
+
+		std::vector<uint8_t> toVector() const; //Copy of the contents
+		void release(); //Return the buffer to its pool now, leaving this handle empty
+	};
+
+	//Power-of-two size classes (minimumSize to maximumSize) carved out of larger slabs, which are only freed with the pool
+	//Freed buffers are cached in stripes, each thread sticking to one stripe, so threads rarely contend for the same lock
+	//Once warmed up, acquiring and releasing buffers never allocates
+	//Requests above maximumSize are allocated individually and freed on release
+	class bufferPool {
+	public:
+		static const size_t minimumSize = 0x1000;
+		static const size_t maximumSize = 0x100000;
+	protected:
+		static const size_t sizeClasses = 9; //log2(maximumSize / minimumSize) + 1
+		static const uint8_t unpooled = 0xFF;
+
+		struct freeList {
+			std::mutex lock;
+			std::vector<uint8_t*> buffers[sizeClasses];
+		};
+		struct slab {
+			uint8_t* memory;
+			size_t size;
+		};
+
+		bool m_hugePages;
+		std::vector<std::unique_ptr<freeList>> m_stripes;
+		freeList m_shared; //Overflow from, and refill for, the stripes
+		std::mutex m_slabsLock;
+		std::vector<slab> m_slabs;
+		std::atomic<size_t> m_slabBytes;
+
+		freeList& stripe();
+		void refill(freeList& list, uint8_t sizeClass); //list is locked by the caller
+		void release(uint8_t* data, uint8_t sizeClass);
+		friend class pooledBuffer;
+	public:
+		//hugePages: back slabs with huge pages where the system allows it (falls back to regular pages)
+		//stripes: number of per-thread caches, 0 for one per hardware thread
+		bufferPool(bool hugePages = false, size_t stripes = 0);
+		bufferPool(const bufferPool&) = delete;
+		~bufferPool(); //Every pooledBuffer from this pool must be destroyed first
+
+		bufferPool& operator=(const bufferPool&) = delete;
+
+		pooledBuffer acquire(size_t size); //Contents are not initialized
+		size_t slabBytes() const; //Memory held by slabs
+
+		static bufferPool& shared(); //Default pool, used by socket::receive(...) when none is given
+	};
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#include "socks.hpp"
+
+namespace sks {
+	class connectionPool;
+
+	//Socket leased from a connectionPool, handed back for reuse on destruction (or release())
+	//discard() a connection left in an unknown state (e.g. a response was not fully read), so it is closed instead
+	class pooledConnection {
+	protected:
+		std::unique_ptr<socket> m_socket;
+		connectionPool* m_pool = nullptr;
+		address m_destination;
+		bool m_reused = false;
+		bool m_discard = false;
+
+		friend class connectionPool;
+		pooledConnection(std::unique_ptr<socket> s, connectionPool* pool, const address& to, bool reused);
+	public:
+		pooledConnection();
+		pooledConnection(const pooledConnection&) = delete;
+		pooledConnection(pooledConnection&& r);
+		~pooledConnection();
+
+		pooledConnection& operator=(const pooledConnection&) = delete;
+		pooledConnection& operator=(pooledConnection&& r);
+
+		socket& operator*();
+		socket* operator->();
+		explicit operator bool() const; //Still leased
+		const address& destination() const;
+		bool reused() const; //Taken from the idle connections, no handshake was needed
+
+		void discard(); //Close rather than return to the pool
+		void release(); //Return (or close) now, leaving this handle empty
+	};
+
+	//Client-side pool of connected stream sockets, keyed by destination address
+	//Idle connections are reused most recently returned first; past maxIdle the least recently used is closed, and idleTimeout closes the rest eventually
+	//Every checkout makes sure the idle connection was not closed by the peer (a zero-timeout readReady(), one poll), so a dead one is never handed out
+	//Destinations are split into shards, each with its own lock; connecting and closing happen outside of it
+	class connectionPool {
+	public:
+		//Per destination
+		struct limits {
+			size_t maxIdle = 8;
+			size_t maxTotal = 64; //Leased and idle; acquire(...) waits while a destination is at its limit
+			std::chrono::milliseconds idleTimeout = std::chrono::seconds(60);
+		};
+		//Makes a new connection to to, a plain stream connect(...) by default
+		typedef std::function<socket(const address& to)> connectFunction;
+	protected:
+		typedef std::chrono::steady_clock clock;
+		struct idleConnection {
+			std::unique_ptr<socket> sock;
+			clock::time_point since;
+		};
+		struct destination {
+			std::deque<idleConnection> idle; //Least recently used first
+			size_t leased = 0;
+			size_t connecting = 0; //Counted towards maxTotal while the connect(...) is in progress
+		};
+		struct shard {
+			std::mutex lock;
+			std::condition_variable returned; //A destination of this shard has a free slot again
+			std::map<address, destination> destinations;
+		};
+
+		limits m_limits;
+		connectFunction m_connect;
+		std::vector<std::unique_ptr<shard>> m_shards;
+
+		shard& shardFor(const address& to);
+		void expire(destination& d, clock::time_point now, std::vector<std::unique_ptr<socket>>& closing); //Move timed out idle connections to closing (shard locked)
+		void release(const address& to, std::unique_ptr<socket> s, bool discard);
+		friend class pooledConnection;
+	public:
+		connectionPool(); //Default limits
+		connectionPool(limits l, connectFunction connect = nullptr, size_t shards = 16);
+		connectionPool(const connectionPool&) = delete;
+		~connectionPool(); //Every pooledConnection from this pool must be released first
+
+		connectionPool& operator=(const connectionPool&) = delete;
+
+		//Idle connection to to if one is alive, otherwise a new one
+		//Waits up to timeout (negative waits indefinitely) if to is at maxTotal, then throws sysErr(ETIMEDOUT)
+		pooledConnection acquire(const address& to, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+		size_t reap(); //Close idle connections past idleTimeout, returns how many
+		void clear(); //Close every idle connection
+
+		size_t idle(); //Idle connections, every destination
+		size_t leased(); //Leased connections, every destination
+	};
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "macros.hpp"
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <chrono>
+
+#include "socks.hpp"
+#include "pollSet.hpp" //eventFlag, triggerMode
+
+namespace sks {
+	//Reactor which dispatches readiness callbacks for registered sockets
+	//Sockets are registered once and only ready sockets are visited per iteration (see pollSet)
+	//Registered sockets must outlive their registration and must not be moved while registered
+	class eventLoop {
+	public:
+		typedef std::function<void(socket& s, int events)> callback; //events is a combination of eventFlag values
+	protected:
+		struct registration {
+			socket* sock;
+			int interest;
+			callback cb;
+			bool active;
+		};
+
+		pollSet m_pollSet; //Tags are registration pointers
+		std::unordered_map<int, std::unique_ptr<registration>> m_registrations; //fd -> registration
+		std::vector<std::unique_ptr<registration>> m_retired; //Removed during dispatch, freed after dispatch completes
+		std::vector<pollSet::event> m_ready; //Sized once, filled every iteration
+		bool m_running = false;
+	public:
+		eventLoop(size_t maxEventsPerIteration = 256);
+		eventLoop(const eventLoop&) = delete;
+
+		eventLoop& operator=(const eventLoop&) = delete;
+
+		//Register s for the given eventFlag combination; cb is called with the events that are ready
+		void add(socket& s, int events, callback cb, triggerMode mode = levelTriggered);
+		//Change what s is registered for
+		void modify(socket& s, int events, triggerMode mode = levelTriggered);
+		//Stop receiving events for s (safe to call from within any callback)
+		void remove(socket& s);
+		bool contains(const socket& s) const;
+		size_t size() const;
+
+		//Wait up to timeout (negative waits indefinitely) and dispatch callbacks for ready sockets
+		//Returns the number of callbacks dispatched
+		size_t runOnce(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+		//Dispatch until stop() is called (from a callback) or no sockets remain registered
+		void run();
+		void stop();
+	};
+};
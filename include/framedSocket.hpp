@@ -0,0 +1,69 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "socks.hpp"
+#include "streamReader.hpp"
+
+namespace sks {
+	//Length header in front of every message of a framedSocket
+	enum lengthPrefix {
+		prefixVarint = 0,	//Unsigned LEB128, 1 byte below 128 and at most 10
+		prefix16 = 2,		//Fixed size, big-endian (network byte order)
+		prefix32 = 4,
+		prefix64 = 8,
+	};
+
+	//Whole-message transfers over a stream socket, each message preceded by its length
+	//Received messages are views into the reader's buffer (see streamReader), valid until the next receive; one fill may yield many messages
+	//Sends write header and body with a single vectored system call
+	//One thread may send while another receives; the socket must outlive this
+	class framedSocket {
+	protected:
+		socket& m_socket;
+		lengthPrefix m_prefix;
+		size_t m_maxMessageSize;
+		streamReader m_reader;
+		size_t m_consumeOnNext = 0; //Bytes of messages handed out by the last receive
+		std::vector<uint8_t> m_joined; //A message wrapping around an unmirrored buffer, made contiguous
+		std::vector<uint8_t> m_headers; //Reused by sendMany(...)
+		std::vector<constBuffer> m_parts;
+
+		size_t encodeHeader(uint64_t length, uint8_t* header) const; //Returns the header size
+		//Parse the message at offset (within the unread bytes) without consuming it
+		//Returns false if it is not fully buffered yet, setting needed to the bytes required from offset (if known)
+		//allowJoin: whether a wrapped message may be copied into m_joined (replacing what it held)
+		bool parse(size_t offset, constBuffer& message, size_t& frameSize, size_t& needed, bool allowJoin = true);
+		void copyOut(size_t offset, uint8_t* to, size_t len) const; //From the unread bytes, across the wrap if there is one
+	public:
+		static const size_t maxHeaderSize = 10;
+
+		//maxMessageSize: larger incoming lengths throw sysErr(EMSGSIZE), as they could never be buffered
+		//bufferCapacity: receive buffer size, 0 to fit one maximum-sized message (and at least 64 KiB)
+		//mirror: see streamReader; without it, messages wrapping around the buffer's end are copied to be contiguous
+		framedSocket(socket& s, lengthPrefix prefix = prefix32, size_t maxMessageSize = 0x100000, size_t bufferCapacity = 0, bool mirror = true);
+		framedSocket(const framedSocket&) = delete;
+
+		framedSocket& operator=(const framedSocket&) = delete;
+
+		//Send one message, optionally gathered from several buffers
+		void send(const uint8_t* data, size_t len, int flags = 0);
+		void send(const std::vector<uint8_t>& message, int flags = 0);
+		void send(const constBuffer* parts, size_t count, int flags = 0);
+		//Send count messages with one vectored call (split only by IOV_MAX)
+		void sendMany(const constBuffer* messages, size_t count, int flags = 0);
+
+		//Wait for the next message; false once the peer closed the connection (a partial message is dropped)
+		bool receive(constBuffer& message, int flags = 0);
+		//Wait for at least one message, then return every complete message already received (up to maxCount)
+		//Returns 0 once the peer closed the connection
+		size_t receiveMany(constBuffer* messages, size_t maxCount, int flags = 0);
+		//Next message if it is already fully buffered, without a system call
+		bool next(constBuffer& message);
+
+		socket& sock();
+		size_t buffered() const; //Received bytes not yet handed out
+	};
+};
@@ -14,6 +14,27 @@ namespace sks {
 	#endif
 	extern bool autoInitialize; //Initialize and finalize the socket library (when applicable) automatically
 
-	void initialize();
-	void deinitialize();
+	#ifdef __SKS_AS_WINDOWS__
+		//WinSock is started by the first reference and cleaned up with the last (thread-safe)
+		void initialize();
+		void deinitialize();
+	#else
+		//POSIX sockets need no set up, so these cost nothing
+		inline void initialize() {}
+		inline void deinitialize() {}
+	#endif
+
+	//Holds a reference (if autoInitialize is set) for its lifetime, for calls which need WinSock but do not involve a socket (e.g. getaddrinfo)
+	struct initializationScope {
+		initializationScope() {
+			if (autoInitialize) {
+				initialize();
+			}
+		}
+		~initializationScope() {
+			if (autoInitialize) {
+				deinitialize();
+			}
+		}
+	};
 };
@@ -0,0 +1,124 @@
+#pragma once
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <poll.h> //pollfd
+	#else
+		#include <winsock2.h> //pollfd
+	#endif
+}
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+
+#include "socks.hpp"
+
+namespace sks {
+	enum ioOperation {
+		ioAccept,
+		ioReceive,
+		ioSend,
+		ioConnect,
+		ioClose,
+	};
+
+	struct ioCompletion {
+		uint64_t tag;			//Tag given when the operation was prepared
+		ioOperation operation;
+		int result;				//Bytes transferred (receive/send), accepted fd (accept, see ioRing::acceptedSocket), or 0 (connect/close); -errno on failure
+		int bufferId;			//Provided buffer holding the received data (see ioRing::buffer), -1 if none was used
+		bool more;				//Multishot operation is still armed and will complete again
+	};
+
+	//Batched asynchronous socket I/O
+	//Uses io_uring when the library was built with it (linux/io_uring.h found by CMake) and the running kernel allows it
+	//Otherwise operations are executed with the regular calls, without waiting, once poll(...) reports them ready (during submit() and reap(...))
+	//Buffers, sockets and addresses passed to an operation must stay valid until its completion is reaped
+	class ioRing {
+	protected:
+		struct kernelRing; //io_uring state, null when the poll-driven fallback is in use
+		struct operation {
+			uint64_t tag;
+			ioOperation op;
+			int fd;
+			uint8_t* buf;
+			size_t len;
+			int flags;
+			bool multishot;
+			bool bufferSelect; //Receive into a provided buffer
+			sockaddr_storage addr; //Connect target (kept here so it outlives the submission)
+			socklen_t addrLen;
+			size_t sent; //Progress of a send (fallback only)
+			bool nonBlocking; //Socket was already non-blocking when the connect was prepared (fallback only)
+			bool connecting; //Connect is in progress, waiting for writability (fallback only)
+		};
+		struct fixedFile {
+			unsigned index;
+			const socket* owner; //Updated as the socket moves, see socket::m_ring
+		};
+
+		std::unique_ptr<kernelRing> m_ring;
+		std::deque<operation> m_operations; //Operation slots, indexed by the kernel's user_data (deque keeps addresses stable)
+		std::vector<size_t> m_freeOperations;
+		std::vector<size_t> m_queued; //Waiting to be run (fallback only); multishot operations stay queued while armed
+		size_t m_prepared = 0; //Prepared since the last submit() (fallback only)
+		std::vector<pollfd> m_pollStructs; //Readiness of m_queued, reused (fallback only)
+		std::deque<ioCompletion> m_completed; //Ready to be reaped (fallback only)
+
+		std::unordered_map<int, fixedFile> m_fixedFiles; //fd -> registered file index
+		std::vector<unsigned> m_freeFixedFiles;
+
+		std::vector<uint8_t> m_bufferMemory; //Provided buffers, contiguous
+		size_t m_bufferSize = 0;
+		std::vector<uint16_t> m_freeBuffers; //Buffer ids available for receives (fallback only)
+
+		size_t prepare(const operation& op);
+		bool runOperation(size_t index); //Returns true if the operation stays queued (multishot still armed, send or connect not yet finished)
+		void runQueued(std::chrono::milliseconds timeout);
+		void forget(const socket& s) noexcept; //unregisterSocket(...) for a socket going away, errors are ignored
+		void moved(const socket& s); //s now holds a registered fd
+
+		friend class socket;
+	public:
+		//entries: submission queue size; fixedFiles: slots reserved for registerSocket(...)
+		//allowIoUring: false forces the poll-driven fallback
+		ioRing(unsigned entries = 256, unsigned fixedFiles = 64, bool allowIoUring = true);
+		ioRing(const ioRing&) = delete;
+		~ioRing();
+
+		ioRing& operator=(const ioRing&) = delete;
+
+		static bool supported(); //True if io_uring was compiled in and can be used by this process
+		bool usingIoUring() const;
+
+		//Registered (fixed) files skip the per-operation file table lookup
+		//A socket can be registered with one ring at a time; it is unregistered when destroyed or its fd is taken (socket::socketFD(true))
+		//Like the ring itself, registered sockets are only to be moved and destroyed on the thread using the ring
+		unsigned registerSocket(const socket& s);
+		void unregisterSocket(const socket& s);
+
+		//Set up count (power of two) buffers of size bytes each, for receives that select their own buffer (multishot receive)
+		void provideBuffers(size_t count, size_t size);
+		uint8_t* buffer(int bufferId);
+		void recycleBuffer(int bufferId); //Return a buffer from a completion so it can be used again
+
+		//Prepare operations; nothing is started until submit()
+		void accept(const socket& listener, uint64_t tag, bool multishot = false);
+		void receive(const socket& s, uint8_t* buf, size_t len, uint64_t tag, int flags = 0);
+		void receive(const socket& s, uint64_t tag, bool multishot = false, int flags = 0); //Into a provided buffer
+		void send(const socket& s, const uint8_t* data, size_t len, uint64_t tag, int flags = 0); //Completes once all data is sent (or on error)
+		void connect(const socket& s, const address& to, uint64_t tag);
+		void close(socket& s, uint64_t tag); //Takes ownership of the socket's file descriptor
+
+		//Start every prepared operation, returns the number submitted
+		size_t submit();
+		//Collect up to capacity completions, waiting up to timeout (negative waits indefinitely) for the first one
+		size_t reap(ioCompletion* results, size_t capacity, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+		//Wrap the fd of a successful accept completion
+		socket acceptedSocket(const socket& listener, int fd) const;
+	};
+};
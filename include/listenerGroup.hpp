@@ -0,0 +1,39 @@
+#pragma once
+#include "macros.hpp"
+#include <vector>
+
+#include "socks.hpp"
+
+namespace sks {
+	//Several sockets bound to the same address (SO_REUSEPORT), each meant to be served by its own thread
+	//The kernel spreads incoming connections (stream/seq) or datagrams (dgram) between the members, so accepting and receiving scale past one core
+	//When steered (Linux), a classic BPF program picks the member by the CPU which received the packet: member i gets CPU i's traffic (modulo size()),
+	//so a thread serving member i on CPU i keeps each connection on the core its packets already arrive on
+	class listenerGroup {
+	protected:
+		std::vector<socket> m_members;
+		address m_address;
+		bool m_steered = false;
+
+		void steer(); //Attach the CPU steering program to the group
+	public:
+		//members: number of sockets, 0 for one per hardware thread; limited to one per hardware thread when steered, see size()
+		//Stream and seq members are listening (with backlog) once constructed; if at has port 0, every member shares the port picked for the first
+		//steerByCPU: attach the CPU steering program, throws if the system does not support it
+		listenerGroup(const address& at, type t, size_t members = 0, bool steerByCPU = false, int backlog = 0xFF, int protocol = 0);
+		listenerGroup(const listenerGroup&) = delete;
+		listenerGroup(listenerGroup&&) = default;
+
+		listenerGroup& operator=(const listenerGroup&) = delete;
+		listenerGroup& operator=(listenerGroup&&) = default;
+
+		size_t size() const;
+		socket& operator[](size_t index);
+		const socket& operator[](size_t index) const;
+		std::vector<socket>::iterator begin();
+		std::vector<socket>::iterator end();
+
+		const address& localAddress() const; //Address every member is bound to
+		bool steered() const;
+	};
+};
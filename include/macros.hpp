@@ -12,6 +12,18 @@ namespace sks {
 		#error System socket implementation unknown
 	#endif
 
+	#ifdef __linux__ //Linux-only extensions (recvmmsg/sendmmsg and friends), portable equivalents are used otherwise
+		#define __SKS_AS_LINUX__
+	#endif
+
+	#if __has_include(<sys/epoll.h>) //Linux readiness notification, poll(...) is used otherwise
+		#define __SKS_HAS_EPOLL__
+	#endif
+
+	#if defined SKS_COROUTINES && __cplusplus >= 202002L && __has_include(<coroutine>) //C++20 coroutines, see scheduler.hpp (SKS_COROUTINES is defined for programs linking the socks target when the library was built with them)
+		#define __SKS_HAS_COROUTINES__
+	#endif
+
 	#if __has_include (<netax25/axlib.h>)
 		//NOTE: This will be uncommented, and support added, once the AX25 kernel rework is completed
 		//#define __SKS_HAS_AX25__
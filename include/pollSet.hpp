@@ -0,0 +1,73 @@
+#pragma once
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <poll.h> //pollfd
+		#ifdef __SKS_HAS_EPOLL__
+			#include <sys/epoll.h> //epoll_event
+		#endif
+	#else
+		#include <winsock2.h> //pollfd
+	#endif
+}
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <chrono>
+
+#include "socks.hpp"
+
+namespace sks {
+	//Readiness events a socket can be registered for (and be notified of)
+	enum eventFlag {
+		readable = 0x01,	//Data (or a connection) is waiting to be read/accepted
+		writable = 0x02,	//Data can be sent without blocking
+		hangup = 0x04,		//Peer closed (at least) its writing half, or an error is pending on the socket (always reported)
+	};
+	enum triggerMode {
+		levelTriggered,	//Notified every wait while the socket is ready
+		edgeTriggered,	//Notified only when the socket becomes ready; caller must read/write until it would block
+	};
+
+	//Long-lived readiness set, the persistent replacement for readReadySockets/writeReadySockets
+	//Interest is registered incrementally and each wait only reports ready entries (epoll where available, poll otherwise)
+	//Waiting performs no heap allocations once a given capacity has been used
+	class pollSet {
+	public:
+		struct event {
+			uint64_t tag;	//Tag given when the file descriptor was added
+			int events;		//Ready events (combination of eventFlag values)
+		};
+	protected:
+		#ifdef __SKS_HAS_EPOLL__
+			int m_epollFD = -1;
+			std::vector<epoll_event> m_events; //Grown to the largest capacity waited with, then reused
+			std::unordered_set<int> m_fds; //Registered, so remove(...) can tell a closed fd (already dropped by epoll) from an unknown one
+		#else
+			std::vector<pollfd> m_pollStructs; //Persistent interest list
+			std::vector<uint64_t> m_tags; //Parallel to m_pollStructs
+			std::unordered_map<int, size_t> m_indices; //fd -> index into m_pollStructs
+		#endif
+	public:
+		pollSet();
+		pollSet(const pollSet&) = delete;
+		~pollSet();
+
+		pollSet& operator=(const pollSet&) = delete;
+
+		//Register for a combination of eventFlag values; tag is reported back when ready
+		void add(int fd, int events, uint64_t tag, triggerMode mode = levelTriggered);
+		void add(const socket& s, int events, uint64_t tag, triggerMode mode = levelTriggered);
+		//Change registered events (and tag)
+		void modify(int fd, int events, uint64_t tag, triggerMode mode = levelTriggered);
+		void modify(const socket& s, int events, uint64_t tag, triggerMode mode = levelTriggered);
+		void remove(int fd);
+		void remove(const socket& s);
+		size_t size() const;
+
+		//Wait up to timeout (negative waits indefinitely) for registered file descriptors to become ready
+		//Up to capacity ready entries are written to results, returns the number written (0 on timeout or interruption)
+		size_t wait(event* results, size_t capacity, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+	};
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+#include "socks.hpp"
+
+namespace sks {
+	//Bidirectional relay between two connected stream sockets (e.g. the two halves of a proxied connection)
+	//On Linux data is moved through a pipe with splice(...), so it never passes through user space; a buffer is used otherwise
+	//When one side stops sending, the other side's write half is shut down once everything buffered has been delivered
+	//Both sockets must outlive the relay
+	class relay {
+	protected:
+		struct direction {
+			socket* from;
+			socket* to;
+			#ifdef __SKS_AS_LINUX__
+				int pipe[2] = { -1, -1 }; //Read and write ends
+			#else
+				std::vector<uint8_t> buffer;
+				size_t start = 0;
+			#endif
+			size_t buffered = 0; //Received but not yet sent
+			uint64_t transferred = 0; //Delivered to the receiving socket
+			#ifdef __SKS_AS_LINUX__
+				bool pipeFull = false; //Out of pipe slots (partial pages use a whole one), reading waits for a write
+			#endif
+			bool ended = false; //from has no more data
+			bool shutDown = false; //to's write half was shut down
+		};
+
+		direction m_aToB;
+		direction m_bToA;
+		size_t m_capacity; //Per direction
+
+		bool wantsRead(const direction& d) const;
+		bool wantsWrite(const direction& d) const;
+		void read(direction& d);
+		void write(direction& d);
+		void finish(direction& d); //Shut down to's write half once from has ended and everything was delivered
+	public:
+		//capacity: bytes buffered per direction before reading pauses
+		relay(socket& a, socket& b, size_t capacity = 0x10000);
+		relay(const relay&) = delete;
+		~relay();
+
+		relay& operator=(const relay&) = delete;
+
+		//Move whatever data is ready, waiting up to timeout (negative waits indefinitely) for either socket
+		//Returns false once both directions have finished
+		bool pump(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+		//Pump until both directions have finished
+		void run();
+		bool finished() const;
+
+		uint64_t bytesAToB() const;
+		uint64_t bytesBToA() const;
+	};
+};
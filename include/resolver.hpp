@@ -0,0 +1,101 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <exception>
+#include <chrono>
+
+#include "addrs.hpp"
+
+namespace sks {
+	//Hostname resolver with a shared cache of results
+	//Successful lookups are kept for positiveTTL, failed ones (including "no addresses") for negativeTTL
+	//Concurrent lookups of the same name wait on a single resolution rather than each calling the lookup function
+	//The cache is split into shards, each with its own lock, so lookups of different names rarely contend
+	//Expired entries are swept out as new names are added, and at most maxEntries are kept (soonest to expire go first)
+	class resolver {
+	public:
+		//Return every address for host (port 0); an empty result or an exception is a failed lookup
+		//d is the domain requested by the caller, (domain)0 for any
+		typedef std::function<std::vector<address>(const std::string& host, domain d)> lookupFunction;
+		//Called with every address found, or with error set (and no addresses) if resolution failed
+		typedef std::function<void(std::vector<address> addresses, std::exception_ptr error)> completionCallback;
+	protected:
+		typedef std::chrono::steady_clock clock;
+		struct result {
+			std::vector<address> addresses;
+			std::exception_ptr error; //Set if the lookup failed
+			clock::time_point expires;
+		};
+		typedef std::shared_future<std::shared_ptr<const result>> pendingResult;
+		struct shard {
+			std::mutex lock;
+			std::unordered_map<std::string, pendingResult> entries; //Keyed by domain and host
+			size_t sweepAt = 0; //Entry count at which the next insert sweeps out expired entries
+		};
+
+		lookupFunction m_lookup;
+		std::chrono::milliseconds m_positiveTTL;
+		std::chrono::milliseconds m_negativeTTL;
+		std::vector<std::unique_ptr<shard>> m_shards;
+		size_t m_shardCapacity; //maxEntries, split between the shards
+
+		//Worker pool for asynchronous lookups, started on first use
+		//Shared with its threads, so a callback which destroys the resolver still has a pool to return to
+		struct pool {
+			std::vector<std::thread> threads;
+			std::deque<std::function<void()>> tasks;
+			std::mutex lock;
+			std::condition_variable changed;
+			bool stopping = false;
+		};
+		size_t m_threadCount;
+		std::shared_ptr<pool> m_pool;
+
+		shard& shardFor(const std::string& key);
+		std::shared_ptr<const result> cached(const std::string& key); //Unexpired, completed result; null otherwise
+		std::shared_ptr<const result> lookup(const std::string& host, domain d);
+		void makeRoom(shard& s); //Before inserting into s, with s.lock held
+		static bool expired(const pendingResult& pending, clock::time_point now); //Completed, and no longer to be used
+		void splitHostPort(const std::string& addrstr, std::string& host, uint16_t& port) const;
+		static std::vector<address> applyResult(const result& r, uint16_t port); //Throws r's error
+		static void work(std::shared_ptr<pool> p);
+	public:
+		//threads: size of the pool running asynchronous lookups
+		//maxEntries: bound on cached results (rounded up to a multiple of shards)
+		resolver(lookupFunction lookup = systemLookup, std::chrono::milliseconds positiveTTL = std::chrono::seconds(60), std::chrono::milliseconds negativeTTL = std::chrono::seconds(5), size_t shards = 16, size_t threads = 2, size_t maxEntries = 0x1000);
+		resolver(const resolver&) = delete;
+		~resolver();
+
+		resolver& operator=(const resolver&) = delete;
+
+		//Every address of host, host:port or [host]:port (each given the port), throws if it could not be resolved
+		//Numeric addresses are parsed directly and skip the cache entirely
+		std::vector<address> resolveAll(const std::string& addrstr, domain d = (domain)0);
+		//First address from resolveAll(...)
+		address resolve(const std::string& addrstr, domain d = (domain)0);
+
+		//Same as resolveAll(...), without blocking the caller
+		//Cached and numeric results complete immediately (the callback runs on the calling thread), others complete on a pool thread
+		//Exceptions thrown by a callback on a pool thread are discarded; a callback may destroy the resolver
+		std::future<std::vector<address>> resolveAllAsync(const std::string& addrstr, domain d = (domain)0);
+		void resolveAllAsync(const std::string& addrstr, completionCallback onComplete, domain d = (domain)0);
+
+		void clear(); //Forget every cached result
+		size_t size(); //Unexpired cached results, including lookups in progress
+
+		//getaddrinfo(...), the default lookup function
+		static std::vector<address> systemLookup(const std::string& host, domain d);
+		//Shared instance used by address(addrstr, resolver::shared()) and similar
+		static resolver& shared();
+	};
+};
@@ -0,0 +1,221 @@
+#pragma once
+#include "macros.hpp"
+#ifndef __SKS_HAS_COROUTINES__
+	#error scheduler.hpp needs C++20 coroutines and a library built with SKS_COROUTINES (defining SKS_COROUTINES)
+#endif
+#include <coroutine>
+#include <optional>
+#include <exception>
+#include <memory>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+
+#include "socks.hpp"
+#include "pollSet.hpp"
+
+namespace sks {
+	class scheduler;
+
+	//Lazily started coroutine producing a T (or void)
+	//A task runs when it is awaited, or when given to scheduler::spawn(...); the awaiting coroutine resumes once it finishes
+	template<typename T>
+	class task {
+	protected:
+		struct promiseBase {
+			std::coroutine_handle<> continuation; //Resumed when this task finishes
+			std::exception_ptr error;
+
+			std::suspend_always initial_suspend() noexcept {
+				return {};
+			}
+			struct finalAwaiter {
+				bool await_ready() noexcept {
+					return false;
+				}
+				template<typename P>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+					std::coroutine_handle<> next = h.promise().continuation;
+					return next ? next : std::noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+			finalAwaiter final_suspend() noexcept {
+				return {};
+			}
+			void unhandled_exception() {
+				error = std::current_exception();
+			}
+		};
+		struct valuePromise : promiseBase {
+			std::optional<T> value;
+
+			task get_return_object() {
+				return task(std::coroutine_handle<valuePromise>::from_promise(*this));
+			}
+			template<typename U>
+			void return_value(U&& v) {
+				value.emplace(std::forward<U>(v));
+			}
+			T result() {
+				if (this->error) {
+					std::rethrow_exception(this->error);
+				}
+				return std::move(*value);
+			}
+		};
+		struct voidPromise : promiseBase {
+			task get_return_object() {
+				return task(std::coroutine_handle<voidPromise>::from_promise(*this));
+			}
+			void return_void() {}
+			void result() {
+				if (this->error) {
+					std::rethrow_exception(this->error);
+				}
+			}
+		};
+	public:
+		typedef std::conditional_t<std::is_void_v<T>, voidPromise, valuePromise> promise_type;
+	protected:
+		std::coroutine_handle<promise_type> m_handle;
+
+		explicit task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+		friend class scheduler;
+	public:
+		task() {}
+		task(const task&) = delete;
+		task(task&& r) : m_handle(r.m_handle) {
+			r.m_handle = nullptr;
+		}
+		~task() {
+			if (m_handle) {
+				m_handle.destroy();
+			}
+		}
+
+		task& operator=(const task&) = delete;
+		task& operator=(task&& r) {
+			if (this != &r) {
+				if (m_handle) {
+					m_handle.destroy();
+				}
+				m_handle = r.m_handle;
+				r.m_handle = nullptr;
+			}
+			return *this;
+		}
+
+		bool done() const {
+			return !m_handle || m_handle.done();
+		}
+
+		//Awaiting starts the task and resumes the awaiting coroutine with its result (or exception)
+		bool await_ready() const noexcept {
+			return done();
+		}
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			m_handle.promise().continuation = awaiting;
+			return m_handle;
+		}
+		T await_resume() {
+			return m_handle.promise().result();
+		}
+	};
+
+	//Single-threaded driver for tasks, resuming them when the sockets they wait on are ready (pollSet, so epoll where available)
+	//Tasks must only use the scheduler from the thread running it; socket::async* functions find it through scheduler::current()
+	class scheduler {
+	public:
+		typedef std::chrono::steady_clock clock;
+	protected:
+		struct taskState;
+		struct waiter {
+			std::coroutine_handle<> handle;
+			taskState* owner;
+			int fd = -1; //-1 for timers only
+			int events = 0;
+			bool hasDeadline = false;
+			std::multimap<clock::time_point, waiter*>::iterator timer;
+			int error = 0; //ETIMEDOUT or ECANCELED
+		};
+		struct taskState {
+			task<void> root;
+			waiter* pending = nullptr; //What the task is suspended on, if anything
+			bool cancelled = false;
+			bool finished = false;
+			std::exception_ptr error;
+		};
+		struct fdWaiters {
+			waiter* reader = nullptr;
+			waiter* writer = nullptr;
+		};
+		struct runnable {
+			std::coroutine_handle<> handle;
+			taskState* owner;
+		};
+
+		pollSet m_pollSet; //Tags are file descriptors
+		std::unordered_map<int, fdWaiters> m_fds;
+		std::multimap<clock::time_point, waiter*> m_timers;
+		std::deque<runnable> m_runnable;
+		std::unordered_map<taskState*, std::shared_ptr<taskState>> m_tasks;
+		std::vector<pollSet::event> m_ready;
+		taskState* m_running = nullptr; //Task being resumed
+
+		void suspend(waiter& w, clock::time_point deadline); //Register w, its task resumes once ready, timed out or cancelled
+		void wake(waiter& w, int error); //Unregister w and queue its task
+		void resume(runnable r);
+	public:
+		//Returned by spawn(...)
+		class taskHandle {
+		protected:
+			scheduler* m_scheduler = nullptr;
+			std::shared_ptr<taskState> m_state;
+
+			taskHandle(scheduler* s, std::shared_ptr<taskState> state);
+			friend class scheduler;
+		public:
+			taskHandle();
+
+			//The task's current (or next) wait throws sysErr(ECANCELED), which it may catch to clean up
+			void cancel();
+			bool done() const;
+			std::exception_ptr error() const; //Exception which ended the task, if any
+		};
+
+		//Awaitable readiness of a file descriptor (eventFlag combination), or a plain timer when fd is -1
+		//Throws sysErr(ETIMEDOUT) once deadline passes, or sysErr(ECANCELED) if the task is cancelled
+		class readiness {
+		protected:
+			scheduler& m_scheduler;
+			waiter m_waiter;
+			clock::time_point m_deadline;
+		public:
+			readiness(scheduler& s, int fd, int events, std::optional<clock::time_point> deadline);
+			bool await_ready() const noexcept;
+			bool await_suspend(std::coroutine_handle<> h);
+			void await_resume();
+		};
+
+		scheduler(size_t maxEventsPerIteration = 256);
+		scheduler(const scheduler&) = delete;
+		~scheduler(); //Unfinished tasks are destroyed without being resumed
+
+		scheduler& operator=(const scheduler&) = delete;
+
+		taskHandle spawn(task<void> t); //Starts on the next runOnce(...)
+		//Resume every task that can make progress, waiting up to timeout (negative waits indefinitely) if none can
+		//Returns the number of resumptions
+		size_t runOnce(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+		void run(); //Until every spawned task has finished
+		size_t size() const; //Unfinished tasks
+
+		readiness ready(const socket& s, int events, std::optional<clock::time_point> deadline = std::nullopt);
+		readiness sleepFor(std::chrono::milliseconds duration);
+
+		static scheduler* current(); //Scheduler running on this thread, null outside of runOnce(...)
+	};
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "socks.hpp"
+#include "eventLoop.hpp"
+#include "listenerGroup.hpp"
+
+namespace sks {
+	class serverWorker;
+	class serverRuntime;
+
+	//Client connection of a serverRuntime, owned by one worker and only to be used from that worker's thread
+	class connection {
+	protected:
+		socket m_socket; //Non-blocking
+		serverWorker& m_worker;
+		uint64_t m_id;
+		std::vector<uint8_t> m_queued; //Sent, but not yet taken by the kernel
+		size_t m_queuedStart = 0;
+		bool m_closing = false;
+		bool m_closed = false;
+
+		friend class serverWorker;
+	public:
+		connection(socket s, serverWorker& w, uint64_t id);
+		connection(const connection&) = delete;
+
+		connection& operator=(const connection&) = delete;
+
+		//Never waits; whatever the kernel does not take now is queued and sent as the socket becomes writable
+		void send(const uint8_t* data, size_t len);
+		void send(const std::vector<uint8_t>& data);
+		void close(); //Once everything queued is sent, then onClose is called
+		size_t queued() const; //Bytes waiting to be sent
+
+		socket& sock();
+		address peer() const; //Recorded while accepting, no system call
+		uint64_t id() const; //Unique within the runtime
+		serverWorker& worker();
+	};
+
+	//Callbacks a serverRuntime calls on its workers' threads
+	//Every worker uses the same handlers, possibly at the same time; state shared between connections on different workers needs its own synchronization (or serverRuntime::post(...))
+	struct serverHandlers {
+		std::function<void(connection& c)> onOpen;
+		std::function<void(connection& c, const uint8_t* data, size_t len)> onData;
+		std::function<void(connection& c)> onClose; //c is destroyed once this returns
+	};
+
+	//One thread of a serverRuntime, with its own listener, event loop and connection table
+	//Nothing here is locked except the inbox for serverRuntime::post(...)
+	//Errors are handled where they happen (ending the connection, pausing accepts, or skipping a failed task) so they never end the thread
+	class serverWorker {
+	public:
+		typedef std::function<void(serverWorker& w)> task;
+	protected:
+		serverRuntime& m_runtime;
+		size_t m_index;
+		socket& m_listener;
+		const serverHandlers& m_handlers;
+		eventLoop m_loop;
+		std::unordered_map<uint64_t, std::unique_ptr<connection>> m_connections;
+		std::vector<std::unique_ptr<connection>> m_retired; //Closed during dispatch, freed after it
+		uint64_t m_nextSequence = 0;
+		std::vector<uint8_t> m_receiveBuffer; //Shared by every connection of this worker
+		bool m_acceptPaused = false; //After accepting failed (e.g. EMFILE), the listener is left alone until m_acceptResume
+		std::chrono::steady_clock::time_point m_acceptResume;
+
+		std::pair<socket, socket> m_wake; //Written by post(...) to interrupt the event loop
+		std::mutex m_inboxLock;
+		std::vector<task> m_inbox;
+		std::vector<task> m_running; //Swapped with m_inbox, so tasks run without the lock
+
+		void accept();
+		void receive(connection& c);
+		void flush(connection& c);
+		void finish(connection& c);
+		void runInbox();
+		void post(task t); //Any thread
+		void run(const std::atomic<bool>& stopping);
+
+		friend class connection;
+		friend class serverRuntime;
+	public:
+		serverWorker(serverRuntime& runtime, size_t index, socket& listener, const serverHandlers& handlers, size_t receiveBufferSize);
+		serverWorker(const serverWorker&) = delete;
+
+		serverWorker& operator=(const serverWorker&) = delete;
+
+		size_t index() const;
+		serverRuntime& runtime();
+		size_t size() const; //Open connections
+		connection* find(uint64_t id); //Null unless the connection is open on this worker
+		void forEach(const std::function<void(connection& c)>& f); //Open connections of this worker
+	};
+
+	//Thread-per-core server: one worker thread per listenerGroup member, each accepting and serving its own connections
+	//When pinned, worker i runs on CPU i (modulo the CPU count) and, on Linux, the listeners steer connections to the worker on the CPU receiving them
+	class serverRuntime {
+	protected:
+		listenerGroup m_listeners;
+		serverHandlers m_handlers;
+		std::vector<std::unique_ptr<serverWorker>> m_workers;
+		std::vector<std::thread> m_threads;
+		std::atomic<bool> m_stopping;
+		bool m_pinned;
+	public:
+		//at: stream address to listen on (port 0 picks one, see localAddress())
+		//workers: 0 for one per hardware thread; when pinned on Linux, at most one per hardware thread (see listenerGroup)
+		serverRuntime(const address& at, serverHandlers handlers, size_t workers = 0, bool pinned = true, size_t receiveBufferSize = 0x10000);
+		serverRuntime(const serverRuntime&) = delete;
+		~serverRuntime(); //stop(), then wait for the workers
+
+		serverRuntime& operator=(const serverRuntime&) = delete;
+
+		void start(); //Run the workers on their own threads
+		void run(); //start(), then wait until stop() is called
+		void stop(); //Any thread; open connections are closed (with onClose) as the workers exit
+		void wait(); //Until every worker has exited
+
+		//Run t on worker's thread, from any thread (e.g. to reach connections owned by another worker)
+		void post(size_t worker, serverWorker::task t);
+		size_t size() const; //Workers
+		const address& localAddress() const;
+	};
+};
@@ -13,7 +13,9 @@ extern "C" {
 }
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <functional>
 #include <chrono>
 #include <stdexcept>
@@ -21,6 +23,7 @@ extern "C" {
 #include <chrono>
 
 #include "addrs.hpp" //Addresses and domains
+#include "bufferPool.hpp" //Pooled receive buffers
 
 namespace sks {
 	struct versionInfo {
@@ -44,6 +47,9 @@ namespace sks {
 		debug = SO_DEBUG,
 		broadcast = SO_BROADCAST,
 		reuseAddr = SO_REUSEADDR,
+		#ifdef SO_REUSEPORT
+		reusePort = SO_REUSEPORT, //See listenerGroup (listenerGroup.hpp)
+		#endif
 		keepAlive = SO_KEEPALIVE,
 
 		outOfBandInLine = SO_OOBINLINE,
@@ -63,6 +69,40 @@ namespace sks {
 	//SO_RCVTIMEO use receiveTimeout(...)
 	//SO_SNDTIMEO use sendTimeout(...)
 
+	//Outcome of a non-blocking transfer, see socket::trySend(...) and socket::tryReceive(...)
+	enum ioStatus {
+		ioDone,			//bytes were transferred (possibly fewer than asked for)
+		ioWouldBlock,	//Nothing could be transferred without waiting
+		ioClosed,		//The peer closed the connection (stream and seq receives only)
+	};
+	struct ioResult {
+		ioStatus status;
+		size_t bytes;
+	};
+
+	//What a socket does with its connection when it is destroyed, see socket::closePolicy(...)
+	enum closeMode {
+		closeFast,		//close(...) only; queued data and the FIN are still sent by the kernel in the background
+		closeShutdown,	//shutdown(...) both directions first, which also ends the connection for duplicated descriptors
+		closeAbortive,	//Reset the connection (SO_LINGER of 0), queued data is discarded and the peer sees ECONNRESET
+		closeDrain,		//Half-close, then discard whatever the peer still sends until it closes or the drain timeout passes
+	};
+
+	//Views over caller-owned memory, used for scatter/gather I/O
+	struct constBuffer {
+		const uint8_t* data;
+		size_t size;
+	};
+	struct mutableBuffer {
+		uint8_t* data;
+		size_t size;
+	};
+
+	class ioRing; //ioRing.hpp
+	#ifdef __SKS_HAS_COROUTINES__
+		template<typename T> class task; //scheduler.hpp
+	#endif
+
 	class socket {
 	protected:
 		bool m_validFD = false; //this is used for move constructor and deconstruction, otherwise we risk closing a different file descriptor unexpectedly.
@@ -70,11 +110,23 @@ namespace sks {
 		domain m_domain; //domain this socket is operating on, cannot be switched (assigned at construction)
 		type m_type; //type of socket this is, cannot be switched (assigned at construction)
 		int m_protocol; //specific protocol of this socket, cannot be switched (assigned at construction)
+		bool m_nonBlocking = false; //Set by nonBlocking(...)
+		bool m_unlinkOnClose = false; //Bound to a named unix address, which is removed on destruction
+		closeMode m_closeMode = closeShutdown; //Set by closePolicy(...)
+		bool m_kernelSegmentation = true; //Cleared once the kernel rejects UDP_SEGMENT, sendSegmented(...) then splits in user space
+		std::chrono::milliseconds m_drainTimeout = std::chrono::milliseconds(0);
+		address m_peer; //Filled in by accepting, so connectedAddress() needs no system call; blank otherwise
+		mutable ioRing* m_ring = nullptr; //Ring this socket is registered with (ioRing::registerSocket(...)), unregistered on destruction
 
 		socket(int sockFD, domain d, type t, int protocol);
 		friend std::pair<socket, socket> createUnixPair(type t, int protocol);
 		friend std::vector<std::reference_wrapper<socket>> writeReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout);
 		friend std::vector<std::reference_wrapper<socket>> readReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout);
+		friend class ioRing;
+
+		ioResult trySend(const uint8_t* data, size_t len, const sockaddr* toAddr, socklen_t addrLen, int flags);
+		ioResult tryReceive(sockaddr* fromAddr, socklen_t* addrLen, uint8_t* buf, size_t bufSize, int flags);
+		void drain(); //closeDrain's half-close and wait, errors are ignored
 	public:
 		socket(domain d, type t, int protocol = 0);
 		socket(const socket& s) = delete; //socket cannot be construction-copied
@@ -108,12 +160,83 @@ namespace sks {
 		size_t receive(address& from, uint8_t* buf, size_t bufSize, int flags = 0);
 		std::vector<uint8_t> receive(sockaddr* fromAddr, socklen_t* addrLen, size_t bufSize = 0x10000, int flags = 0);
 		size_t receive(sockaddr* fromAddr, socklen_t* addrLen, uint8_t* buf, size_t bufSize, int flags = 0);
+		//Receive into a buffer taken from pool rather than a newly allocated (and zeroed) vector
+		pooledBuffer receive(bufferPool& pool, size_t bufSize = 0x10000, int flags = 0);
+		pooledBuffer receive(address& from, bufferPool& pool, size_t bufSize = 0x10000, int flags = 0);
+		//Scatter/gather variants, the buffers are sent/filled in order without being joined first
+		void send(const std::vector<constBuffer>& buffers, int flags = 0);
+		void send(const constBuffer* buffers, size_t count, int flags = 0);
+		void send(const std::vector<constBuffer>& buffers, const address& to, int flags = 0);
+		void send(const constBuffer* buffers, size_t count, const address& to, int flags = 0);
+		size_t receive(const std::vector<mutableBuffer>& buffers, int flags = 0);
+		size_t receive(const mutableBuffer* buffers, size_t count, int flags = 0);
+		size_t receive(address& from, const std::vector<mutableBuffer>& buffers, int flags = 0);
+		size_t receive(address& from, const mutableBuffer* buffers, size_t count, int flags = 0);
+		//Batched datagram variants, transferring up to count datagrams with one system call (recvmmsg/sendmmsg) where available
+		//peers/peerLengths may be null; sendMany(...) then sends to the connected address
+		//receiveMany(...) waits up to timeout (negative waits indefinitely) for the first datagram, then takes what is already queued
+		//lengths[i] is the size of datagram i; for dgram sockets on Linux this is the full size, which is larger than buffers[i].size if it was truncated
+		size_t receiveMany(const mutableBuffer* buffers, size_t* lengths, sockaddr_storage* peers, socklen_t* peerLengths, size_t count, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1), int flags = 0);
+		void sendMany(const constBuffer* buffers, const sockaddr_storage* peers, const socklen_t* peerLengths, size_t count, int flags = 0);
+		//UDP segmentation offload (dgram IPv4/IPv6), data is split into segmentSize datagrams by the kernel (UDP_SEGMENT) or in user space where unsupported
+		//That is when UDP_SEGMENT isn't compiled in, or after the kernel or device first rejected it for this socket
+		void sendSegmented(const uint8_t* data, size_t len, uint16_t segmentSize, int flags = 0);
+		void sendSegmented(const uint8_t* data, size_t len, uint16_t segmentSize, const address& to, int flags = 0);
+		//UDP receive offload, see receiveCoalescing(...); segmentSize is set to the size of each datagram in buf (the last may be shorter)
+		//bufSize should be at least 0x10000 to hold a full coalesced packet
+		size_t receiveCoalesced(uint8_t* buf, size_t bufSize, uint16_t& segmentSize, int flags = 0);
+		size_t receiveCoalesced(address& from, uint8_t* buf, size_t bufSize, uint16_t& segmentSize, int flags = 0);
+		//Transfer length bytes of a file starting at offset, without passing through user space where supported (sendfile)
+		void sendFile(int fileFD, uint64_t offset, size_t length);
+		void sendFile(const std::string& path, uint64_t offset = 0, size_t length = SIZE_MAX); //length is limited to the end of the file
+		//Transfer what can be sent without waiting, advancing offset; returns the number of bytes sent (0 if the socket is not writable)
+		//Throws sysErr(ENODATA) if the file ends at offset; only non-blocking sockets use sendfile, others copy through a buffer
+		size_t trySendFile(int fileFD, uint64_t& offset, size_t length);
+
+		//Non-blocking usage functions
+		//These never wait and never throw for would-block conditions, whether or not the socket is in non-blocking mode; other errors still throw
+		//trySend(...) may send only part of the data, the rest is left to the caller (e.g. once pollSet reports the socket writable)
+		ioResult trySend(const uint8_t* data, size_t len, int flags = 0);
+		ioResult trySend(const uint8_t* data, size_t len, const address& to, int flags = 0);
+		ioResult tryReceive(uint8_t* buf, size_t bufSize, int flags = 0);
+		ioResult tryReceive(address& from, uint8_t* buf, size_t bufSize, int flags = 0);
+		//Null if no connection is pending; a blocking listener is polled first, and may still wait if another thread accepts the connection first
+		std::unique_ptr<socket> tryAccept();
+		//Accept up to maxCount pending connections without waiting (accept4 where available), empty if none are pending
+		//A non-blocking listener saves a poll(...) per connection, and never waits on connections taken by other threads (see tryAccept())
+		//nonBlockingPeers: accepted sockets start in non-blocking mode (SOCK_NONBLOCK), saving a system call each to switch them later
+		//Accepted sockets (from any accept function) already know their peer, see connectedAddress()
+		std::vector<socket> acceptMany(size_t maxCount = 64, bool nonBlockingPeers = true);
+
+		//Closing functions
+		void shutdownWrite(); //Send a FIN (stream) or end of record stream (seq), receiving still works until the peer closes
+		//How the connection is ended on destruction, closeShutdown by default; closeFast saves the shutdown(...) call
+		//drainTimeout only applies to closeDrain, and bounds how long the destructor may wait for the peer
+		void closePolicy(closeMode mode, std::chrono::milliseconds drainTimeout = std::chrono::milliseconds(1000));
+		closeMode closePolicy() const;
+
+		#ifdef __SKS_HAS_COROUTINES__
+			//Coroutine usage functions (scheduler.hpp), to be awaited from a task running on a scheduler
+			//The socket is waited on through the scheduler instead of blocking the thread; it must outlive the returned task
+			//timeout covers the whole call (negative waits indefinitely); expiry throws sysErr(ETIMEDOUT), cancelling the task throws sysErr(ECANCELED)
+			task<size_t> asyncReceive(uint8_t* buf, size_t bufSize, int flags = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)); //0 once the peer closed the connection
+			task<void> asyncSend(const uint8_t* data, size_t len, int flags = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)); //Completes once all data is sent
+			task<void> asyncSend(const std::vector<uint8_t>& data, int flags = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+			task<socket> asyncAccept(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+			task<void> asyncConnect(address to, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+		#endif
 
 		//Critical utility functions
 		void sendTimeout(std::chrono::microseconds timeout);
 		std::chrono::microseconds sendTimeout() const;
 		void receiveTimeout(std::chrono::microseconds timeout);
 		std::chrono::microseconds receiveTimeout() const;
+		void receiveCoalescing(bool enable); //Let the kernel coalesce datagrams from one sender into a single receive (UDP_GRO)
+		bool receiveCoalescing() const;
+		//Non-blocking mode (O_NONBLOCK/FIONBIO): calls which would wait throw sysErr (EAGAIN/EWOULDBLOCK) instead, possibly part-way through a send
+		//Use the try* functions with non-blocking sockets, they report how much was transferred
+		void nonBlocking(bool enable);
+		bool nonBlocking() const;
 		bool writeReady(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) const;
 		bool readReady(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) const; //NOTE: Returns true if the remote socket is closed; check if receive returns a vector of size 0
 		size_t bytesReady() const;
@@ -125,6 +248,7 @@ namespace sks {
 		int socketOption(intOption option, optionLevel level = socketLevel) const;
 
 		//Important utility functions
+		//Cached for accepted sockets, which then keep returning the peer after the connection is gone (rather than throwing ENOTCONN)
 		address connectedAddress() const;
 		void connectedAddress(sockaddr* addr, socklen_t* len) const;
 		address localAddress() const;
@@ -138,6 +262,7 @@ namespace sks {
 	std::pair<socket, socket> createUnixPair(type t, int protocol = 0);
 
 	//readReady and writeReady for a group of sockets.
+	//These rebuild the interest list every call; use a pollSet (pollSet.hpp) when waiting on the same sockets repeatedly
 	std::vector<std::reference_wrapper<socket>> writeReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 	std::vector<std::reference_wrapper<socket>> readReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 
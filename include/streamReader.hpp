@@ -0,0 +1,50 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <cstddef>
+
+#include "socks.hpp"
+
+namespace sks {
+	//Buffered reader for stream sockets, for parsing data in place
+	//Received bytes sit in a power-of-two ring buffer; a fill(...) reads into every free segment with a single receive
+	//Unread bytes are viewed with peek(...) and dropped with consume(...), so nothing is ever moved
+	//When mirrored (Linux, memfd), the ring is mapped twice back-to-back, so the unread bytes are always one contiguous segment
+	//The socket must outlive the reader
+	class streamReader {
+	protected:
+		socket& m_socket;
+		uint8_t* m_memory = nullptr;
+		size_t m_capacity; //Power of two
+		uint64_t m_head = 0; //Total bytes consumed
+		uint64_t m_tail = 0; //Total bytes received
+		bool m_mirrored = false;
+		bool m_ended = false;
+	public:
+		//capacity is rounded up to a power of two (and the page size when mirrored)
+		//mirror: map the buffer twice where supported, otherwise fall back to a regular buffer
+		streamReader(socket& s, size_t capacity = 0x10000, bool mirror = true);
+		streamReader(const streamReader&) = delete;
+		~streamReader();
+
+		streamReader& operator=(const streamReader&) = delete;
+
+		//Receive as much as the kernel holds and fits, in one call; blocks like socket::receive(...)
+		//Returns the number of bytes added, 0 if the buffer is full or the peer closed the connection (see ended())
+		size_t fill(int flags = 0);
+		//fill(...) until at least n bytes are unread; false if the connection ended first
+		//n must not exceed capacity()
+		bool fillUntil(size_t n, int flags = 0);
+
+		//Unread bytes, in order; the second segment is empty unless the data wraps around (never when mirrored)
+		constBuffer peek() const; //First segment only
+		size_t peek(constBuffer segments[2]) const; //Returns the number of non-empty segments
+		void consume(size_t n); //Drop the first n unread bytes, n must not exceed available()
+
+		size_t available() const; //Unread bytes
+		size_t space() const; //Free bytes
+		size_t capacity() const;
+		bool mirrored() const;
+		bool ended() const; //Peer closed the connection
+	};
+};
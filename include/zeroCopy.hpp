@@ -0,0 +1,52 @@
+#pragma once
+#include "macros.hpp"
+#include <cstdint>
+#include <functional>
+#include <deque>
+#include <chrono>
+
+#include "socks.hpp"
+
+namespace sks {
+	//Sends large buffers without copying them into the kernel (SO_ZEROCOPY/MSG_ZEROCOPY)
+	//Each send returns a token, and the buffer must stay untouched until the release callback is called with that token
+	//Completions are only collected by drainCompletions(...), which should be called whenever the socket reports an error event (e.g. pollSet's hangup)
+	//The socket must not be used for zero-copy sends by anything else, since notifications are matched by counting sends
+	//Where zero-copy is unsupported, or the kernel reports it had to copy the data anyway (e.g. loopback), sends fall back to regular copies
+	class zeroCopySender {
+	public:
+		typedef std::function<void(uint32_t token, bool copied)> releaseCallback; //copied: the kernel copied the data after all
+	protected:
+		struct pendingSend {
+			uint32_t token;
+			uint32_t firstID; //Range of kernel notification IDs used by this send
+			uint32_t lastID;
+			size_t remaining; //IDs not yet reported complete
+			bool copied;
+		};
+
+		socket& m_socket;
+		releaseCallback m_release;
+		bool m_zeroCopy = false; //False once the kernel copies, or if unsupported
+		bool m_notifying = false; //Zero-copy was enabled, so notifications may be queued
+		uint32_t m_nextToken = 0;
+		uint32_t m_nextID = 0; //Mirrors the kernel's per-socket notification counter
+		std::deque<pendingSend> m_pending;
+
+		void complete(uint32_t firstID, uint32_t lastID, bool copied);
+		size_t releaseFinished();
+	public:
+		zeroCopySender(socket& s, releaseCallback onRelease);
+		zeroCopySender(const zeroCopySender&) = delete;
+
+		zeroCopySender& operator=(const zeroCopySender&) = delete;
+
+		//Blocks until all data is handed to the kernel, like socket::send(...)
+		uint32_t send(const uint8_t* data, size_t len, int flags = 0);
+		//Read completion notifications and release finished sends, waiting up to timeout (negative waits indefinitely) for the first if none are ready
+		//Returns the number of sends released
+		size_t drainCompletions(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+		size_t pending() const; //Sends whose buffers are still in use
+		bool usingZeroCopy() const;
+	};
+};
@@ -1,8 +1,11 @@
 #include "addrs.hpp"
 #include "errors.hpp"
 #include "initialization.hpp"
+#include "resolver.hpp"
 #include <cstring>
 #include <regex>
+#include <cstddef> //offsetof
+#include <type_traits>
 #include "macros.hpp"
 extern "C" {
 	#if defined __SKS_AS_POSIX__ //SHOULD be true if POSIX, false otherwise
@@ -25,61 +28,268 @@ extern "C" {
 
 namespace sks {
 
-	address::address() {
-		m_domain = (domain)0xFF; //Set to invalid domain
+	//Formatting helpers; names are built in a local buffer then copied out, so nothing is allocated
+	static size_t copyName(const char* name, size_t len, char* buf, size_t bufSize) {
+		if (bufSize > 0) {
+			size_t n = len < bufSize - 1 ? len : bufSize - 1;
+			memcpy(buf, name, n);
+			buf[n] = '\0';
+		}
+		return len;
+	}
+	static size_t writeDecimal(char* out, uint32_t value) {
+		char digits[10];
+		size_t n = 0;
+		do {
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = digits[n - 1 - i];
+		}
+		return n;
+	}
+	static size_t formatIPv4(const in_addr& addr, uint16_t port, char* buf, size_t bufSize) {
+		char name[22]; //255.255.255.255:65535
+		const uint8_t* bytes = (const uint8_t*)&addr;
+		size_t len = 0;
+		for (size_t i = 0; i < 4; i++) {
+			len += writeDecimal(name + len, bytes[i]);
+			name[len++] = i < 3 ? '.' : ':';
+		}
+		len += writeDecimal(name + len, port);
+		return copyName(name, len, buf, bufSize);
+	}
+	static size_t formatIPv6(const in6_addr& addr, uint16_t port, char* buf, size_t bufSize) {
+		char name[64]; //[ + INET6_ADDRSTRLEN + ]:65535
+		name[0] = '[';
+		if (inet_ntop(AF_INET6, (void*)&addr, name + 1, sizeof(name) - 8) == nullptr) {
+			return copyName("", 0, buf, bufSize);
+		}
+		size_t len = strlen(name);
+		name[len++] = ']';
+		name[len++] = ':';
+		len += writeDecimal(name + len, port);
+		return copyName(name, len, buf, bufSize);
+	}
+	static size_t formatUnix(const char* path, size_t len, char* buf, size_t bufSize) {
+		if (len > 0 && path[0] != '\0') {
+			return copyName(path, strnlen(path, len), buf, bufSize); //pathname, can be displayed as is
+		} else if (len == 0) {
+			return copyName("unnamed unix address", 20, buf, bufSize);
+		} else {
+			return copyName("abstract unix address", 21, buf, bufSize);
+		}
+	}
+
+	//Literal parsers for the common numeric forms; they never throw or touch the resolver
+	//false only means "not a numeric literal", the string may still be resolvable (e.g. a hostname)
+	static bool parseDecimal(const char* p, const char* end, uint32_t max, uint32_t& value) {
+		if (p == end || end - p > 5) {
+			return false;
+		}
+		value = 0;
+		for (; p < end; p++) {
+			if (*p < '0' || *p > '9') {
+				return false;
+			}
+			value = value * 10 + (*p - '0');
+		}
+		return value <= max;
+	}
+	static bool parseIPv4Bytes(const char* p, const char* end, uint8_t* bytes) {
+		for (size_t i = 0; i < 4; i++) {
+			const char* octetEnd = p;
+			while (octetEnd < end && *octetEnd != '.') {
+				octetEnd++;
+			}
+			if ((i < 3) == (octetEnd == end)) {
+				return false; //Too few or too many octets
+			}
+			uint32_t octet;
+			if (octetEnd - p > 3 || (octetEnd - p > 1 && *p == '0') || !parseDecimal(p, octetEnd, 255, octet)) {
+				return false; //Leading zeros are left to the resolver, which may read them as octal
+			}
+			bytes[i] = octet;
+			p = octetEnd + 1;
+		}
+		return true;
+	}
+	static bool parseIPv6Words(const char* p, const char* end, uint16_t* words) {
+		size_t n = 0;
+		size_t gap = 0; //Index of "::", if there is one
+		bool gapped = false;
+		if (end - p >= 2 && p[0] == ':' && p[1] == ':') {
+			gapped = true;
+			p += 2;
+		}
+		while (p < end) {
+			const char* groupEnd = p;
+			bool dotted = false;
+			while (groupEnd < end && *groupEnd != ':') {
+				dotted |= *groupEnd == '.';
+				groupEnd++;
+			}
+			if (dotted) {
+				//Embedded IPv4 address, only allowed as the last 32 bits
+				uint8_t bytes[4];
+				if (groupEnd != end || n > 6 || !parseIPv4Bytes(p, end, bytes)) {
+					return false;
+				}
+				words[n++] = (bytes[0] << 8) | bytes[1];
+				words[n++] = (bytes[2] << 8) | bytes[3];
+				break;
+			}
+			if (groupEnd == p || groupEnd - p > 4 || n == 8) {
+				return false;
+			}
+			uint16_t word = 0;
+			for (; p < groupEnd; p++) {
+				char c = *p;
+				if (c >= '0' && c <= '9') {
+					word = (word << 4) | (c - '0');
+				} else if (c >= 'a' && c <= 'f') {
+					word = (word << 4) | (c - 'a' + 10);
+				} else if (c >= 'A' && c <= 'F') {
+					word = (word << 4) | (c - 'A' + 10);
+				} else {
+					return false; //Includes scope ids (%), which are left to the resolver
+				}
+			}
+			words[n++] = word;
+			if (p == end) {
+				break;
+			}
+			p++; //':'
+			if (p < end && *p == ':') {
+				if (gapped) {
+					return false; //Only one "::" allowed
+				}
+				gapped = true;
+				gap = n;
+				p++;
+			} else if (p == end) {
+				return false; //Trailing single ':'
+			}
+		}
+		if (!gapped) {
+			return n == 8;
+		}
+		if (n == 8) {
+			return false; //"::" must stand for at least one group
+		}
+		//Move the groups after "::" to the end, zero the gap
+		size_t tail = n - gap;
+		for (size_t i = 0; i < tail; i++) {
+			words[7 - i] = words[n - 1 - i];
+		}
+		for (size_t i = gap; i < 8 - tail; i++) {
+			words[i] = 0;
+		}
+		return true;
+	}
+	//a.b.c.d or a.b.c.d:port
+	static bool parseIPv4Literal(const std::string& addrstr, sockaddr_in& addr) {
+		const char* p = addrstr.data();
+		const char* end = p + addrstr.size();
+		const char* colon = (const char*)memchr(p, ':', addrstr.size());
+		uint32_t port = 0;
+		if (colon != nullptr && !parseDecimal(colon + 1, end, 0xFFFF, port)) {
+			return false;
+		}
+		memset(&addr, 0, sizeof(addr));
+		if (!parseIPv4Bytes(p, colon != nullptr ? colon : end, (uint8_t*)&addr.sin_addr)) {
+			return false;
+		}
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		return true;
+	}
+	//f:f::f, [f:f::f] or [f:f::f]:port
+	static bool parseIPv6Literal(const std::string& addrstr, sockaddr_in6& addr) {
+		const char* p = addrstr.data();
+		const char* end = p + addrstr.size();
+		uint32_t port = 0;
+		if (p < end && *p == '[') {
+			const char* close = (const char*)memchr(p, ']', addrstr.size());
+			if (close == nullptr) {
+				return false;
+			}
+			if (close + 1 != end && (close[1] != ':' || !parseDecimal(close + 2, end, 0xFFFF, port))) {
+				return false;
+			}
+			p++;
+			end = close;
+		}
+		uint16_t words[8];
+		if (!parseIPv6Words(p, end, words)) {
+			return false;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sin6_family = AF_INET6;
+		uint8_t* bytes = (uint8_t*)&addr.sin6_addr;
+		for (size_t i = 0; i < 8; i++) {
+			bytes[i * 2] = words[i] >> 8;
+			bytes[i * 2 + 1] = words[i] & 0xFF;
+		}
+		addr.sin6_port = htons(port);
+		return true;
 	}
+
+	//Extract the name bytes of a unix address, the same way unixAddress(const sockaddr_un&, socklen_t) does
+	static void unixName(const sockaddr_storage& from, socklen_t len, const char*& name, size_t& nameLen) {
+		const sockaddr_un& addr = *(const sockaddr_un*)&from;
+		name = addr.sun_path;
+		if ((size_t)len > offsetof(sockaddr_un, sun_path) + 1 && addr.sun_path[0] != '\0') {
+			nameLen = len - offsetof(sockaddr_un, sun_path) - 1; //pathname
+		} else if ((size_t)len > sizeof(sa_family_t)) {
+			nameLen = len - sizeof(sa_family_t); //abstract
+		} else {
+			nameLen = 0; //unnamed
+		}
+	}
+
+	static_assert(std::is_trivially_copyable<address>::value, "address must stay trivially copyable (no allocations on copy)");
+
+	address::address() {}
 	address::address(const std::string& addrstr, domain d) {
+		//Numeric literals are parsed directly, without the resolver or exceptions
+		if (parseNumeric(addrstr, *this, d)) {
+			return;
+		}
+
 		//If we are not given a specific domain to check, try to parse as: IPv6, IPv4
-		m_domain = d;
 		switch (d) {
 			case IPv4:
-				{
-					IPv4Address addr(addrstr);
-					m_addresses.IPv4 = new IPv4Address(addr);
-				}
+				*this = address(IPv4Address(addrstr));
 				break;
 			case IPv6:
-				{
-					IPv6Address addr(addrstr);
-					m_addresses.IPv6 = new IPv6Address(addr);
-				}
+				*this = address(IPv6Address(addrstr));
 				break;
 			case unix:
-				{
-					unixAddress addr(addrstr);
-					m_addresses.unix = new unixAddress(addr);
-				}
+				*this = address(unixAddress(addrstr));
 				break;
 			#ifdef __SKS_HAS_AX25__
 				case ax25:
-					{
-						ax25Address addr(addrstr);
-						m_addresses.ax25 = new ax25Address(addr);
-					}
+					*this = address(ax25Address(addrstr));
 					break;
 			#endif
 
 			default: //No/unknown domain given, do guess-and-check address resolving
 				//Try to resolve as an IPv6
 				try {
-					IPv6Address addr(addrstr);
-					m_addresses.IPv6 = new IPv6Address(addr);
-					m_domain = IPv6;
+					*this = address(IPv6Address(addrstr));
 					break;
 				} catch (const std::exception& e) {} //Do nothing, just try the next one
 				//Try to resolve as an IPv4
 				try {
-					IPv4Address addr(addrstr);
-					m_addresses.IPv4 = new IPv4Address(addr);
-					m_domain = IPv4;
+					*this = address(IPv4Address(addrstr));
 					break;
 				} catch (const std::exception& e) {}
 				#ifdef __SKS_HAS_AX25__
 					//Try to resolve as an ax25
 					try {
-						ax25Address addr(addrstr);
-						m_addresses.ax25 = new ax25Address(addr);
-						m_domain = ax25;
+						*this = address(ax25Address(addrstr));
 						break;
 					} catch (const std::exception& e) {}
 				#endif
@@ -87,123 +297,153 @@ namespace sks {
 				throw std::runtime_error("Could not parse string to address. You may need to specify domain.");
 		}
 	}
+	address::address(const std::string& addrstr, resolver& r, domain d) {
+		if (d == unix) {
+			*this = address(unixAddress(addrstr));
+		#ifdef __SKS_HAS_AX25__
+		} else if (d == ax25) {
+			*this = address(ax25Address(addrstr));
+		#endif
+		} else {
+			*this = r.resolve(addrstr, d);
+		}
+	}
 	address::address(const sockaddr_storage& from, socklen_t len) {
 		assign(from, len);
 	}
 	address::address(const addressBase& addr) {
 		assign((sockaddr_storage)addr, addr.size());
 	}
-	address::address(const address& addr) {
-		if (addr.size() > 0) {
-			assign((sockaddr_storage)addr, addr.size());
-		} else {
-			m_domain = addr.m_domain;
-		}
-	}
-	address::address(address&& addr) {
-		m_domain = addr.m_domain;
-		m_addresses = addr.m_addresses;
-		addr.m_addresses.base = nullptr; //We now own the data, remove addr's pointer
-	}
-	address::~address() {
-		delete m_addresses.base;
-	}
-	address& address::operator=(const address& addr) {
-		if (addr.size() > 0) {
-			assign((sockaddr_storage)addr, addr.size());
-		} else {
-			m_domain = addr.m_domain;
-			delete m_addresses.base;
-		}
-		return *this;
-	}
-	address& address::operator=(address&& addr) {
-		m_domain = addr.m_domain;
-		m_addresses = addr.m_addresses;
-		addr.m_addresses.base = nullptr; //We now own the data, remove addr's pointer
-		return *this;
-	}
 	void address::assign(const sockaddr_storage& from, socklen_t len) {
-		delete m_addresses.base;
-		m_domain = (domain)from.ss_family;
+		socklen_t size;
 		switch (from.ss_family) {
 			case IPv4:
-				m_addresses.IPv4 = new IPv4Address(*(sockaddr_in*)&from);
+				size = sizeof(sockaddr_in);
 				break;
 			case IPv6:
-				m_addresses.IPv6 = new IPv6Address(*(sockaddr_in6*)&from);
+				size = sizeof(sockaddr_in6);
 				break;
 			case unix:
-				m_addresses.unix = new unixAddress(*(sockaddr_un*)&from, len);
+				size = len > (socklen_t)sizeof(sa_family_t) ? len : sizeof(sa_family_t);
+				if ((size_t)size > sizeof(sockaddr_un)) {
+					throw sysErr(EINVAL);
+				}
 				break;
 			#ifdef __SKS_HAS_AX25__
 				case ax25:
-					m_addresses.ax25 = new ax25Address(*(full_sockaddr_ax25*)&from, len);
+					size = len;
 					break;
 			#endif
 			default:
 				//Domain not supported
 				throw sysErr(EFAULT);
 		}
+		memcpy(&m_storage, &from, size);
+		if (size > len) {
+			memset((uint8_t*)&m_storage + len, 0, size - len); //Caller gave less than the full struct
+		}
+		m_size = size;
+		m_domain = (domain)from.ss_family;
+	}
+	bool address::parseNumeric(const std::string& addrstr, address& to, domain d) {
+		sockaddr_storage addr;
+		if ((d == (domain)0 || d == IPv6) && parseIPv6Literal(addrstr, *(sockaddr_in6*)&addr)) {
+			to.assign(addr, sizeof(sockaddr_in6));
+			return true;
+		}
+		if ((d == (domain)0 || d == IPv4) && parseIPv4Literal(addrstr, *(sockaddr_in*)&addr)) {
+			to.assign(addr, sizeof(sockaddr_in));
+			return true;
+		}
+		return false;
 	}
+
 	address::operator sockaddr_storage() const {
-		return (sockaddr_storage)*m_addresses.base;
+		return m_storage;
 	}
 	socklen_t address::size() const {
-		if (m_addresses.base == nullptr) {
-			return 0;
-		}
-		return m_addresses.base->size();
+		return m_size;
 	}
 	address::operator IPv4Address() const {
 		if (m_domain != IPv4) {
 			throw std::runtime_error("Cannot convert address domain");
 		}
-		return *m_addresses.IPv4;
+		return IPv4Address(*(const sockaddr_in*)&m_storage);
 	}
 	address::operator IPv6Address() const {
 		if (m_domain != IPv6) {
 			throw std::runtime_error("Cannot convert address domain");
 		}
-		return *m_addresses.IPv6;
+		return IPv6Address(*(const sockaddr_in6*)&m_storage);
 	}
 	address::operator unixAddress() const {
 		if (m_domain != unix) {
 			throw std::runtime_error("Cannot convert address domain");
 		}
-		return *m_addresses.unix;
+		return unixAddress(*(const sockaddr_un*)&m_storage, m_size);
 	}
 	#ifdef __SKS_HAS_AX25__
 	address::operator ax25Address() const {
 		if (m_domain != ax25) {
 			throw std::runtime_error("Cannot convert address domain");
 		}
-		return *m_addresses.ax25;
+		return ax25Address(*(const full_sockaddr_ax25*)&m_storage, m_size);
 	}
 	#endif
+	//Three-way comparison with the same ordering as the specific address classes' operator<
+	static int compareAddresses(domain d, const sockaddr_storage& l, socklen_t lLen, const sockaddr_storage& r, socklen_t rLen) {
+		switch (d) {
+			case IPv4:
+				{
+					const sockaddr_in& a = *(const sockaddr_in*)&l;
+					const sockaddr_in& b = *(const sockaddr_in*)&r;
+					int c = memcmp(&a.sin_addr, &b.sin_addr, 4); //Network order, so byte-wise matches numeric order
+					if (c != 0) {
+						return c;
+					}
+					return (int)ntohs(a.sin_port) - (int)ntohs(b.sin_port);
+				}
+			case IPv6:
+				{
+					const sockaddr_in6& a = *(const sockaddr_in6*)&l;
+					const sockaddr_in6& b = *(const sockaddr_in6*)&r;
+					int c = memcmp(&a.sin6_addr, &b.sin6_addr, 16);
+					if (c != 0) {
+						return c;
+					}
+					return (int)ntohs(a.sin6_port) - (int)ntohs(b.sin6_port);
+				}
+			case unix:
+				{
+					const char* a;
+					size_t aLen;
+					const char* b;
+					size_t bLen;
+					unixName(l, lLen, a, aLen);
+					unixName(r, rLen, b, bLen);
+					int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+					if (c != 0) {
+						return c;
+					}
+					return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+				}
+			#ifdef __SKS_HAS_AX25__
+			case ax25:
+				throw std::logic_error("NOT YET SUPPORTED");
+			#endif
+			default:
+				throw sysErr(EINVAL); //Unknown domain. Invalid argument(s)
+		}
+	}
 	bool address::operator==(const address& r) const {
-
 		if (m_domain == r.m_domain) {
 			//One or both addresses are "blank" (uninitialized)
-			if (m_addresses.base == nullptr || r.m_addresses.base == nullptr) {
-				return m_addresses.base == r.m_addresses.base; //Compare pointers
+			if (m_size == 0 || r.m_size == 0) {
+				return m_size == r.m_size;
 			}
 
 			//Normal case
-			switch (m_domain) {
-				case IPv4:
-					return *m_addresses.IPv4 == *r.m_addresses.IPv4;
-				case IPv6:
-					return *m_addresses.IPv6 == *r.m_addresses.IPv6;
-				case unix:
-					return *m_addresses.unix == *r.m_addresses.unix;
-				#ifdef __SKS_HAS_AX25__
-				case ax25:
-					return *m_addresses.ax25 == *r.m_addresses.ax25;
-				#endif
-				default:
-					throw sysErr(EINVAL); //Unknown domain. Invalid argument(s)
-			}
+			return compareAddresses(m_domain, m_storage, m_size, r.m_storage, r.m_size) == 0;
 		}
 		//Different domains, no match
 		return false;
@@ -214,59 +454,65 @@ namespace sks {
 	bool address::operator<(const address& r) const {
 		if (m_domain != r.m_domain) {
 			return m_domain < r.m_domain;
-		} else if (m_addresses.base == nullptr || r.m_addresses.base == nullptr) {
-			return m_addresses.base < r.m_addresses.base; //Compare pointers
+		} else if (m_size == 0 || r.m_size == 0) {
+			return m_size < r.m_size; //Blank addresses sort first
 		}
+		return compareAddresses(m_domain, m_storage, m_size, r.m_storage, r.m_size) < 0;
+	}
+	domain address::addressDomain() const {
+		return m_domain;
+	}
+	std::string address::name() const {
+		char buf[maxNameLength];
+		size_t len = formatTo(buf, sizeof(buf));
+		return std::string(buf, len < sizeof(buf) ? len : sizeof(buf) - 1);
+	}
+	size_t address::formatTo(char* buf, size_t bufSize) const {
 		switch (m_domain) {
 			case IPv4:
-				return *m_addresses.IPv4 < *r.m_addresses.IPv4;
+				{
+					const sockaddr_in& addr = *(const sockaddr_in*)&m_storage;
+					return formatIPv4(addr.sin_addr, ntohs(addr.sin_port), buf, bufSize);
+				}
 			case IPv6:
-				return *m_addresses.IPv6 < *r.m_addresses.IPv6;
+				{
+					const sockaddr_in6& addr = *(const sockaddr_in6*)&m_storage;
+					return formatIPv6(addr.sin6_addr, ntohs(addr.sin6_port), buf, bufSize);
+				}
 			case unix:
-				return *m_addresses.unix < *r.m_addresses.unix;
+				{
+					const char* name;
+					size_t nameLen;
+					unixName(m_storage, m_size, name, nameLen);
+					return formatUnix(name, nameLen, buf, bufSize);
+				}
 			#ifdef __SKS_HAS_AX25__
 			case ax25:
-				return *m_addresses.ax25 == *r.m_addresses.ax25;
+				return ((ax25Address)*this).formatTo(buf, bufSize);
 			#endif
 			default:
-				throw sysErr(EINVAL); //Unknown domain. Invalid argument(s)
+				return copyName("blank address", 13, buf, bufSize);
 		}
 	}
-	domain address::addressDomain() const {
-		return m_domain;
-	}
-	std::string address::name() const {
-		return m_addresses.base->name();
-	}
 
-	addressBase::addressBase() {
-		if (autoInitialize) {
-			initialize(); //addresses cause initialization because WSA needs to be running to parse addresses
-		}
-	}
-	addressBase::addressBase(const addressBase& r) {
-		if (autoInitialize) {
-			initialize();
-		}
-	}
-	addressBase::addressBase(addressBase&& r) {
-		if (autoInitialize) {
-			initialize();
-		}
-	}
-	addressBase::~addressBase() {
-		if (autoInitialize) {
-			deinitialize();
-		}
-	}
+	//Addresses hold no library reference, only resolving them needs WinSock (see initializationScope)
+	addressBase::addressBase() {}
+	addressBase::addressBase(const addressBase&) {}
+	addressBase::addressBase(addressBase&&) {}
+	addressBase::~addressBase() {}
 
 	IPv4Address::IPv4Address(uint16_t port) : IPv4Address("0.0.0.0:" + std::to_string(port)) {} //Construct an any address
 	IPv4Address::IPv4Address(const std::string& addrstr) { //Parse address from string
-		m_name = addrstr;
+		sockaddr_in literal;
+		if (parseIPv4Literal(addrstr, literal)) {
+			memcpy(m_addr.data(), &literal.sin_addr, 4);
+			m_port = ntohs(literal.sin_port);
+			return;
+		}
 		//Parse it!
 		/*Accepted formats:
 		 *	x.x.x.x
-		 *		accepted by getaddrinfo
+		 *		parsed above (as is x.x.x.x:port), otherwise accepted by getaddrinfo
 		 *	x.x.x.x:port
 		 *		\d{1-3}\.\d{1-3}\.\d{1-3}\.\d{1-3}:\d{1-5}
 		 *	http://google.com
@@ -296,6 +542,7 @@ namespace sks {
 		hint.ai_flags = AI_CANONNAME;
 		
 		//Function
+		initializationScope winsock; //getaddrinfo needs WSA on windows
 		addrinfo* results = nullptr;
 		int error;
 		if (scheme != "") {
@@ -330,13 +577,7 @@ namespace sks {
 	IPv4Address::IPv4Address(const sockaddr_in& addr) { //Construct from C struct
 		memcpy(m_addr.data(), &addr.sin_addr, 4);
 		m_port = ntohs(addr.sin_port);
-		//Set m_name accordingly
-		char str[64]; //64 should cover everything for IPv4
-		const char* r = inet_ntop(IPv4, &addr.sin_addr, str, 64);
-		if (r == nullptr) {
-			throw sysErr(errno);
-		}
-		m_name = std::string(r) + ":" + std::to_string(m_port);
+		//Name is formatted on demand by name()/formatTo(...)
 	}
 	IPv4Address::operator sockaddr_in() const { //Cast to C struct
 		sockaddr_in addr;
@@ -375,7 +616,14 @@ namespace sks {
 		return m_port;
 	}
 	std::string IPv4Address::name() const {
-		return m_name;
+		char buf[22];
+		size_t len = formatTo(buf, sizeof(buf));
+		return std::string(buf, len);
+	}
+	size_t IPv4Address::formatTo(char* buf, size_t bufSize) const {
+		in_addr addr;
+		memcpy(&addr, m_addr.data(), 4);
+		return formatIPv4(addr, m_port, buf, bufSize);
 	}
 	
 	void swapEndian(uint16_t* first, size_t n) {
@@ -386,7 +634,13 @@ namespace sks {
 	
 	IPv6Address::IPv6Address(uint16_t port) : IPv6Address("[::]:" + std::to_string(port)) {} //Construct an any address
 	IPv6Address::IPv6Address(const std::string& addrstr) { //Parse address from string
-		m_name = addrstr;
+		sockaddr_in6 literal;
+		if (parseIPv6Literal(addrstr, literal)) {
+			memcpy(m_addr.data(), &literal.sin6_addr, 16);
+			swapEndian(m_addr.data(), m_addr.size());
+			m_port = ntohs(literal.sin6_port);
+			return;
+		}
 		//Parse it!
 		/*Accepted formats:
 		 *	f:f:f:f:f:f:f:f
@@ -426,6 +680,7 @@ namespace sks {
 		hint.ai_flags = AI_CANONNAME;
 		
 		//Function
+		initializationScope winsock; //getaddrinfo needs WSA on windows
 		addrinfo* results = nullptr;
 		int error;
 		if (scheme != "") { 
@@ -467,13 +722,7 @@ namespace sks {
 		m_port = ntohs(addr.sin6_port);
 		m_flowInfo = addr.sin6_flowinfo;
 		m_scopeId = addr.sin6_scope_id;
-		//Set m_name accordingly
-		char str[64]; //64 should cover everything for IPv6
-		const char* r = inet_ntop(IPv6, &addr.sin6_addr, str, 64);
-		if (r == nullptr) {
-			throw sysErr(errno);
-		}
-		m_name = "[" + std::string(r) + "]:" + std::to_string(m_port);
+		//Name is formatted on demand by name()/formatTo(...)
 	}
 	IPv6Address::operator sockaddr_in6() const { //Cast to C struct
 		sockaddr_in6 addr;
@@ -529,7 +778,15 @@ namespace sks {
 		return m_scopeId;
 	}
 	std::string IPv6Address::name() const {
-		return m_name;
+		char buf[64];
+		size_t len = formatTo(buf, sizeof(buf));
+		return std::string(buf, len < sizeof(buf) ? len : sizeof(buf) - 1);
+	}
+	size_t IPv6Address::formatTo(char* buf, size_t bufSize) const {
+		in6_addr addr;
+		memcpy(&addr, m_addr.data(), 16);
+		swapEndian((uint16_t*)&addr, 8);
+		return formatIPv6(addr, m_port, buf, bufSize);
 	}
 
 	unixAddress::unixAddress(const std::string& addrstr) { //Parse address from string
@@ -600,6 +857,9 @@ namespace sks {
 			return "abstract unix address";
 		}
 	}
+	size_t unixAddress::formatTo(char* buf, size_t bufSize) const {
+		return formatUnix(m_addr.data(), m_addr.size(), buf, bufSize);
+	}
 	bool unixAddress::named() const {
 		return m_addr.size() > 0 && m_addr[0] != '\0';
 	}
@@ -678,5 +938,8 @@ namespace sks {
 	std::string ax25Address::name() const {
 		return m_name;
 	}
+	size_t ax25Address::formatTo(char* buf, size_t bufSize) const {
+		return copyName(m_name.data(), m_name.size(), buf, bufSize);
+	}
 	#endif
 };
@@ -0,0 +1,238 @@
+#include "bufferPool.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/mman.h> //mmap(...)
+	#elif defined __SKS_AS_WINDOWS__
+		#include <windows.h> //VirtualAlloc(...)
+		#define errno GetLastError()
+	#endif
+}
+#include <thread>
+#include <stdexcept>
+
+namespace sks {
+	static const size_t minimumSlabSize = 0x40000;
+	static const size_t hugePageSize = 0x200000;
+	static const size_t stripeCapacity = 32; //Buffers cached per stripe and size class before half move to the shared list
+	static const size_t refillCount = stripeCapacity / 2;
+
+	static uint8_t sizeClassOf(size_t size) {
+		uint8_t c = 0;
+		while ((bufferPool::minimumSize << c) < size) {
+			c++;
+		}
+		return c;
+	}
+	static size_t sizeOfClass(uint8_t sizeClass) {
+		return bufferPool::minimumSize << sizeClass;
+	}
+
+	pooledBuffer::pooledBuffer() {}
+	pooledBuffer::pooledBuffer(uint8_t* data, size_t size, size_t capacity, bufferPool* pool, uint8_t sizeClass) : m_data(data), m_size(size), m_capacity(capacity), m_pool(pool), m_sizeClass(sizeClass) {}
+	pooledBuffer::pooledBuffer(pooledBuffer&& r) : m_data(r.m_data), m_size(r.m_size), m_capacity(r.m_capacity), m_pool(r.m_pool), m_sizeClass(r.m_sizeClass) {
+		r.m_data = nullptr;
+		r.m_size = 0;
+		r.m_capacity = 0;
+		r.m_pool = nullptr;
+	}
+	pooledBuffer::~pooledBuffer() {
+		release();
+	}
+	pooledBuffer& pooledBuffer::operator=(pooledBuffer&& r) {
+		if (this != &r) {
+			release();
+			m_data = r.m_data;
+			m_size = r.m_size;
+			m_capacity = r.m_capacity;
+			m_pool = r.m_pool;
+			m_sizeClass = r.m_sizeClass;
+			r.m_data = nullptr;
+			r.m_size = 0;
+			r.m_capacity = 0;
+			r.m_pool = nullptr;
+		}
+		return *this;
+	}
+
+	uint8_t* pooledBuffer::data() {
+		return m_data;
+	}
+	const uint8_t* pooledBuffer::data() const {
+		return m_data;
+	}
+	size_t pooledBuffer::size() const {
+		return m_size;
+	}
+	size_t pooledBuffer::capacity() const {
+		return m_capacity;
+	}
+	bool pooledBuffer::empty() const {
+		return m_size == 0;
+	}
+	void pooledBuffer::resize(size_t size) {
+		if (size > m_capacity) {
+			throw std::length_error("pooledBuffer cannot grow past its capacity");
+		}
+		m_size = size;
+	}
+
+	uint8_t& pooledBuffer::operator[](size_t index) {
+		return m_data[index];
+	}
+	const uint8_t& pooledBuffer::operator[](size_t index) const {
+		return m_data[index];
+	}
+	uint8_t* pooledBuffer::begin() {
+		return m_data;
+	}
+	uint8_t* pooledBuffer::end() {
+		return m_data + m_size;
+	}
+	const uint8_t* pooledBuffer::begin() const {
+		return m_data;
+	}
+	const uint8_t* pooledBuffer::end() const {
+		return m_data + m_size;
+	}
+
+	std::vector<uint8_t> pooledBuffer::toVector() const {
+		return std::vector<uint8_t>(begin(), end());
+	}
+	void pooledBuffer::release() {
+		if (m_pool != nullptr) {
+			m_pool->release(m_data, m_sizeClass);
+		}
+		m_data = nullptr;
+		m_size = 0;
+		m_capacity = 0;
+		m_pool = nullptr;
+	}
+
+	bufferPool::bufferPool(bool hugePages, size_t stripes) : m_hugePages(hugePages), m_slabBytes(0) {
+		if (stripes == 0) {
+			stripes = std::thread::hardware_concurrency();
+			if (stripes == 0) {
+				stripes = 1;
+			}
+		}
+		m_stripes.resize(stripes);
+		for (std::unique_ptr<freeList>& s : m_stripes) {
+			s.reset(new freeList());
+			for (std::vector<uint8_t*>& buffers : s->buffers) {
+				buffers.reserve(stripeCapacity + 1); //Never reallocates while in use
+			}
+		}
+	}
+	bufferPool::~bufferPool() {
+		for (const slab& s : m_slabs) {
+			#ifdef __SKS_AS_POSIX__
+				munmap(s.memory, s.size);
+			#elif defined __SKS_AS_WINDOWS__
+				VirtualFree(s.memory, 0, MEM_RELEASE);
+			#endif
+		}
+	}
+
+	bufferPool::freeList& bufferPool::stripe() {
+		static std::atomic<size_t> nextStripe(0);
+		thread_local size_t index = nextStripe++;
+		return *m_stripes[index % m_stripes.size()];
+	}
+	void bufferPool::refill(freeList& list, uint8_t sizeClass) {
+		std::vector<uint8_t*>& to = list.buffers[sizeClass];
+		std::lock_guard<std::mutex> guard(m_shared.lock);
+		std::vector<uint8_t*>& from = m_shared.buffers[sizeClass];
+
+		if (from.empty()) {
+			//Carve a new slab
+			size_t bufferSize = sizeOfClass(sizeClass);
+			size_t slabSize = bufferSize > minimumSlabSize ? bufferSize : minimumSlabSize;
+			uint8_t* memory = nullptr;
+			#ifdef __SKS_AS_POSIX__
+				void* m = MAP_FAILED;
+				if (m_hugePages) {
+					slabSize = (slabSize + hugePageSize - 1) / hugePageSize * hugePageSize;
+					#ifdef MAP_HUGETLB
+						m = mmap(nullptr, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+					#endif
+				}
+				if (m == MAP_FAILED) {
+					m = mmap(nullptr, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					if (m == MAP_FAILED) {
+						throw sysErr(errno);
+					}
+					#ifdef MADV_HUGEPAGE
+						if (m_hugePages) {
+							madvise(m, slabSize, MADV_HUGEPAGE); //Transparent huge pages instead, if enabled
+						}
+					#endif
+				}
+				memory = (uint8_t*)m;
+			#elif defined __SKS_AS_WINDOWS__
+				//Large pages need SeLockMemoryPrivilege, so regular pages are always used
+				memory = (uint8_t*)VirtualAlloc(nullptr, slabSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+				if (memory == nullptr) {
+					throw sysErr(errno);
+				}
+			#endif
+			{
+				std::lock_guard<std::mutex> slabsGuard(m_slabsLock);
+				m_slabs.push_back({ memory, slabSize });
+			}
+			m_slabBytes += slabSize;
+
+			size_t count = slabSize / bufferSize;
+			from.reserve(from.size() + count); //Enough room for every buffer of this class, so releases never reallocate
+			for (size_t i = 0; i < count; i++) {
+				from.push_back(memory + i * bufferSize);
+			}
+		}
+
+		size_t count = from.size() < refillCount ? from.size() : refillCount;
+		to.insert(to.end(), from.end() - count, from.end());
+		from.resize(from.size() - count);
+	}
+	void bufferPool::release(uint8_t* data, uint8_t sizeClass) {
+		if (sizeClass == unpooled) {
+			delete[] data;
+			return;
+		}
+		freeList& list = stripe();
+		std::lock_guard<std::mutex> guard(list.lock);
+		std::vector<uint8_t*>& buffers = list.buffers[sizeClass];
+		buffers.push_back(data);
+		if (buffers.size() > stripeCapacity) {
+			//Let other threads have some, this thread frees more than it takes
+			std::lock_guard<std::mutex> sharedGuard(m_shared.lock);
+			std::vector<uint8_t*>& shared = m_shared.buffers[sizeClass];
+			shared.insert(shared.end(), buffers.end() - refillCount, buffers.end());
+			buffers.resize(buffers.size() - refillCount);
+		}
+	}
+
+	pooledBuffer bufferPool::acquire(size_t size) {
+		if (size > maximumSize) {
+			return pooledBuffer(new uint8_t[size], size, size, this, unpooled);
+		}
+		uint8_t sizeClass = sizeClassOf(size);
+		freeList& list = stripe();
+		std::lock_guard<std::mutex> guard(list.lock);
+		std::vector<uint8_t*>& buffers = list.buffers[sizeClass];
+		if (buffers.empty()) {
+			refill(list, sizeClass);
+		}
+		uint8_t* data = buffers.back();
+		buffers.pop_back();
+		return pooledBuffer(data, size, sizeOfClass(sizeClass), this, sizeClass);
+	}
+	size_t bufferPool::slabBytes() const {
+		return m_slabBytes;
+	}
+
+	bufferPool& bufferPool::shared() {
+		static bufferPool instance;
+		return instance;
+	}
+};
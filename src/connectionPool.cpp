@@ -0,0 +1,228 @@
+#include "connectionPool.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+
+namespace sks {
+	pooledConnection::pooledConnection() {}
+	pooledConnection::pooledConnection(std::unique_ptr<socket> s, connectionPool* pool, const address& to, bool reused) : m_socket(std::move(s)), m_pool(pool), m_destination(to), m_reused(reused) {}
+	pooledConnection::pooledConnection(pooledConnection&& r) : m_socket(std::move(r.m_socket)), m_pool(r.m_pool), m_destination(r.m_destination), m_reused(r.m_reused), m_discard(r.m_discard) {
+		r.m_pool = nullptr;
+	}
+	pooledConnection::~pooledConnection() {
+		try {
+			release();
+		} catch (...) {} //Throwing in a deconstructor is bad
+	}
+
+	pooledConnection& pooledConnection::operator=(pooledConnection&& r) {
+		if (this != &r) {
+			release();
+			m_socket = std::move(r.m_socket);
+			m_pool = r.m_pool;
+			m_destination = r.m_destination;
+			m_reused = r.m_reused;
+			m_discard = r.m_discard;
+			r.m_pool = nullptr;
+		}
+		return *this;
+	}
+
+	socket& pooledConnection::operator*() {
+		return *m_socket;
+	}
+	socket* pooledConnection::operator->() {
+		return m_socket.get();
+	}
+	pooledConnection::operator bool() const {
+		return m_socket != nullptr;
+	}
+	const address& pooledConnection::destination() const {
+		return m_destination;
+	}
+	bool pooledConnection::reused() const {
+		return m_reused;
+	}
+
+	void pooledConnection::discard() {
+		m_discard = true;
+	}
+	void pooledConnection::release() {
+		if (m_pool != nullptr && m_socket) {
+			m_pool->release(m_destination, std::move(m_socket), m_discard);
+		}
+		m_socket.reset();
+		m_pool = nullptr;
+	}
+
+	static socket connectStream(const address& to) {
+		socket s(to.addressDomain(), stream);
+		s.connect(to);
+		return s;
+	}
+
+	connectionPool::connectionPool() : connectionPool(limits()) {}
+	connectionPool::connectionPool(limits l, connectFunction connect, size_t shards) : m_limits(l), m_connect(connect ? std::move(connect) : connectStream) {
+		if (m_limits.maxTotal == 0) {
+			m_limits.maxTotal = 1;
+		}
+		for (size_t i = 0; i < (shards > 0 ? shards : 1); i++) {
+			m_shards.emplace_back(new shard());
+		}
+	}
+	connectionPool::~connectionPool() {
+		clear();
+	}
+
+	connectionPool::shard& connectionPool::shardFor(const address& to) {
+		//FNV-1a over the raw address, cheaper than formatting its name
+		sockaddr_storage raw = to;
+		const uint8_t* bytes = (const uint8_t*)&raw;
+		uint64_t hash = 0xcbf29ce484222325;
+		for (socklen_t i = 0; i < to.size(); i++) {
+			hash = (hash ^ bytes[i]) * 0x100000001b3;
+		}
+		return *m_shards[hash % m_shards.size()];
+	}
+	void connectionPool::expire(destination& d, clock::time_point now, std::vector<std::unique_ptr<socket>>& closing) {
+		while (!d.idle.empty() && now - d.idle.front().since >= m_limits.idleTimeout) {
+			closing.push_back(std::move(d.idle.front().sock));
+			d.idle.pop_front();
+		}
+	}
+	void connectionPool::release(const address& to, std::unique_ptr<socket> s, bool discard) {
+		std::vector<std::unique_ptr<socket>> closing; //Closed once unlocked
+		shard& sh = shardFor(to);
+		{
+			std::lock_guard<std::mutex> guard(sh.lock);
+			destination& d = sh.destinations[to];
+			d.leased--;
+			if (discard || m_limits.maxIdle == 0) {
+				closing.push_back(std::move(s));
+			} else {
+				d.idle.push_back({ std::move(s), clock::now() });
+				if (d.idle.size() > m_limits.maxIdle) {
+					closing.push_back(std::move(d.idle.front().sock)); //Least recently used
+					d.idle.pop_front();
+				}
+			}
+		}
+		sh.returned.notify_all();
+	}
+
+	pooledConnection connectionPool::acquire(const address& to, std::chrono::milliseconds timeout) {
+		shard& sh = shardFor(to);
+		clock::time_point deadline = clock::now() + timeout;
+		while (true) {
+			std::unique_ptr<socket> candidate;
+			std::vector<std::unique_ptr<socket>> closing;
+			{
+				std::unique_lock<std::mutex> guard(sh.lock);
+				destination& d = sh.destinations[to];
+				expire(d, clock::now(), closing);
+				if (!d.idle.empty()) {
+					//Most recently used first, it is the least likely to have been closed by the peer
+					candidate = std::move(d.idle.back().sock);
+					d.idle.pop_back();
+					d.leased++;
+				} else if (d.leased + d.connecting < m_limits.maxTotal) {
+					d.connecting++; //Hold the slot while connecting without the lock
+					break;
+				} else if (timeout.count() < 0) {
+					sh.returned.wait(guard); //At the limit, wait for a connection to come back
+					continue;
+				} else if (sh.returned.wait_until(guard, deadline) == std::cv_status::timeout) {
+					throw sysErr(ETIMEDOUT);
+				} else {
+					continue;
+				}
+			}
+			closing.clear();
+			//Nothing should be waiting on an idle connection, readable means the peer closed it (or sent something unexpected)
+			bool stale;
+			try {
+				stale = candidate->readReady(std::chrono::milliseconds(0));
+			} catch (const std::system_error& e) {
+				stale = true; //Can't be checked, so it can't be trusted either; release(...) still gives back its slot
+			}
+			if (!stale) {
+				return pooledConnection(std::move(candidate), this, to, true);
+			}
+			release(to, std::move(candidate), true);
+		}
+
+		std::unique_ptr<socket> s;
+		try {
+			s.reset(new socket(m_connect(to)));
+		} catch (...) {
+			{
+				std::lock_guard<std::mutex> guard(sh.lock);
+				sh.destinations[to].connecting--;
+			}
+			sh.returned.notify_all();
+			throw;
+		}
+		{
+			std::lock_guard<std::mutex> guard(sh.lock);
+			destination& d = sh.destinations[to];
+			d.connecting--;
+			d.leased++;
+		}
+		return pooledConnection(std::move(s), this, to, false);
+	}
+	size_t connectionPool::reap() {
+		size_t reaped = 0;
+		clock::time_point now = clock::now();
+		for (std::unique_ptr<shard>& sh : m_shards) {
+			std::vector<std::unique_ptr<socket>> closing;
+			{
+				std::lock_guard<std::mutex> guard(sh->lock);
+				for (auto it = sh->destinations.begin(); it != sh->destinations.end();) {
+					expire(it->second, now, closing);
+					if (it->second.idle.empty() && it->second.leased == 0 && it->second.connecting == 0) {
+						it = sh->destinations.erase(it); //Forget destinations no longer in use
+					} else {
+						it++;
+					}
+				}
+			}
+			reaped += closing.size();
+		}
+		return reaped;
+	}
+	void connectionPool::clear() {
+		for (std::unique_ptr<shard>& sh : m_shards) {
+			std::vector<std::unique_ptr<socket>> closing;
+			{
+				std::lock_guard<std::mutex> guard(sh->lock);
+				for (auto& entry : sh->destinations) {
+					for (idleConnection& c : entry.second.idle) {
+						closing.push_back(std::move(c.sock));
+					}
+					entry.second.idle.clear();
+				}
+			}
+			sh->returned.notify_all(); //Slots freed for waiting acquire(...) calls
+		}
+	}
+
+	size_t connectionPool::idle() {
+		size_t count = 0;
+		for (std::unique_ptr<shard>& sh : m_shards) {
+			std::lock_guard<std::mutex> guard(sh->lock);
+			for (auto& entry : sh->destinations) {
+				count += entry.second.idle.size();
+			}
+		}
+		return count;
+	}
+	size_t connectionPool::leased() {
+		size_t count = 0;
+		for (std::unique_ptr<shard>& sh : m_shards) {
+			std::lock_guard<std::mutex> guard(sh->lock);
+			for (auto& entry : sh->destinations) {
+				count += entry.second.leased;
+			}
+		}
+		return count;
+	}
+};
@@ -0,0 +1,72 @@
+#include "eventLoop.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+
+namespace sks {
+	eventLoop::eventLoop(size_t maxEventsPerIteration) {
+		m_ready.resize(maxEventsPerIteration > 0 ? maxEventsPerIteration : 1);
+	}
+
+	void eventLoop::add(socket& s, int events, callback cb, triggerMode mode) {
+		int fd = s.socketFD();
+		if (m_registrations.count(fd) != 0) {
+			throw sysErr(EEXIST); //Already registered
+		}
+		std::unique_ptr<registration> r(new registration{ &s, events, std::move(cb), true });
+		m_pollSet.add(fd, events, (uint64_t)(uintptr_t)r.get(), mode);
+		m_registrations[fd] = std::move(r);
+	}
+	void eventLoop::modify(socket& s, int events, triggerMode mode) {
+		auto it = m_registrations.find(s.socketFD());
+		if (it == m_registrations.end()) {
+			throw sysErr(ENOENT); //Not registered
+		}
+		m_pollSet.modify(it->first, events, (uint64_t)(uintptr_t)it->second.get(), mode);
+		it->second->interest = events;
+	}
+	void eventLoop::remove(socket& s) {
+		auto it = m_registrations.find(s.socketFD());
+		if (it == m_registrations.end()) {
+			throw sysErr(ENOENT); //Not registered
+		}
+		m_pollSet.remove(it->first);
+		//Events may still be queued for this registration in the current iteration, keep it alive until dispatch completes
+		it->second->active = false;
+		m_retired.push_back(std::move(it->second));
+		m_registrations.erase(it);
+	}
+	bool eventLoop::contains(const socket& s) const {
+		return m_registrations.count(s.socketFD()) != 0;
+	}
+	size_t eventLoop::size() const {
+		return m_registrations.size();
+	}
+
+	size_t eventLoop::runOnce(std::chrono::milliseconds timeout) {
+		size_t ready = m_pollSet.wait(m_ready.data(), m_ready.size(), timeout);
+
+		//Dispatch; callbacks may add/remove registrations, so removed ones are skipped (and freed afterwards)
+		size_t dispatched = 0;
+		for (size_t i = 0; i < ready; i++) {
+			registration* reg = (registration*)(uintptr_t)m_ready[i].tag;
+			int events = m_ready[i].events & (reg->interest | hangup);
+			if (!reg->active || events == 0) {
+				continue;
+			}
+			reg->cb(*reg->sock, events);
+			dispatched++;
+		}
+		m_retired.clear();
+		return dispatched;
+	}
+	void eventLoop::run() {
+		m_running = true;
+		while (m_running && !m_registrations.empty()) {
+			runOnce();
+		}
+		m_running = false;
+	}
+	void eventLoop::stop() {
+		m_running = false;
+	}
+};
@@ -0,0 +1,225 @@
+#include "framedSocket.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+#include <cstring>
+
+namespace sks {
+	static size_t capacityFor(size_t maxMessageSize, size_t bufferCapacity) {
+		if (bufferCapacity > 0) {
+			return bufferCapacity;
+		}
+		size_t needed = maxMessageSize + framedSocket::maxHeaderSize;
+		return needed > 0x10000 ? needed : 0x10000;
+	}
+
+	framedSocket::framedSocket(socket& s, lengthPrefix prefix, size_t maxMessageSize, size_t bufferCapacity, bool mirror) : m_socket(s), m_prefix(prefix), m_maxMessageSize(maxMessageSize), m_reader(s, capacityFor(maxMessageSize, bufferCapacity), mirror) {
+		if (m_prefix == prefix16 && m_maxMessageSize > 0xFFFF) {
+			m_maxMessageSize = 0xFFFF;
+		}
+		if (m_maxMessageSize + maxHeaderSize > m_reader.capacity()) {
+			throw sysErr(EINVAL); //bufferCapacity could not hold a maximum-sized message
+		}
+	}
+
+	size_t framedSocket::encodeHeader(uint64_t length, uint8_t* header) const {
+		if (m_prefix == prefixVarint) {
+			size_t size = 0;
+			do {
+				uint8_t b = length & 0x7F;
+				length >>= 7;
+				header[size++] = length != 0 ? b | 0x80 : b;
+			} while (length != 0);
+			return size;
+		}
+		for (size_t i = 0; i < (size_t)m_prefix; i++) {
+			header[i] = (uint8_t)(length >> (8 * (m_prefix - 1 - i)));
+		}
+		return m_prefix;
+	}
+	void framedSocket::copyOut(size_t offset, uint8_t* to, size_t len) const {
+		constBuffer segments[2];
+		m_reader.peek(segments);
+		if (offset < segments[0].size) {
+			size_t first = segments[0].size - offset < len ? segments[0].size - offset : len;
+			memcpy(to, segments[0].data + offset, first);
+			to += first;
+			len -= first;
+			offset = 0;
+		} else {
+			offset -= segments[0].size;
+		}
+		memcpy(to, segments[1].data + offset, len);
+	}
+	bool framedSocket::parse(size_t offset, constBuffer& message, size_t& frameSize, size_t& needed, bool allowJoin) {
+		size_t unread = m_reader.available() - offset;
+		uint8_t header[maxHeaderSize];
+		size_t headerSize = m_prefix == prefixVarint ? (unread < maxHeaderSize ? unread : maxHeaderSize) : (size_t)m_prefix;
+		if (unread < headerSize || unread == 0) {
+			needed = m_prefix == prefixVarint ? 1 : headerSize;
+			return false;
+		}
+		copyOut(offset, header, headerSize);
+
+		uint64_t length = 0;
+		if (m_prefix == prefixVarint) {
+			size_t i = 0;
+			while (true) {
+				if (i == headerSize) {
+					if (headerSize == maxHeaderSize) {
+						throw sysErr(EBADMSG); //Longer than any 64-bit length
+					}
+					needed = headerSize + 1; //Header continues past what was received
+					return false;
+				}
+				uint8_t group = header[i];
+				if (i == maxHeaderSize - 1 && group > 1) {
+					throw sysErr(EBADMSG); //The 10th byte only holds bit 63, anything more would be dropped (and could wrap to a small length)
+				}
+				length |= (uint64_t)(group & 0x7F) << (7 * i);
+				i++;
+				if ((group & 0x80) == 0) {
+					if (group == 0 && i > 1) {
+						throw sysErr(EBADMSG); //Non-canonical, ends in a zero group that encodeHeader(...) would never write
+					}
+					break;
+				}
+			}
+			headerSize = i;
+		} else {
+			for (size_t i = 0; i < headerSize; i++) {
+				length = (length << 8) | header[i];
+			}
+		}
+		if (length > m_maxMessageSize) {
+			throw sysErr(EMSGSIZE);
+		}
+
+		frameSize = headerSize + length;
+		if (unread < frameSize) {
+			needed = frameSize;
+			return false;
+		}
+		//A view straight into the buffer, unless the message wraps around an unmirrored one
+		constBuffer segments[2];
+		m_reader.peek(segments);
+		size_t start = offset + headerSize;
+		if (start + length <= segments[0].size) {
+			message = { segments[0].data + start, length };
+		} else if (start >= segments[0].size) {
+			message = { segments[1].data + (start - segments[0].size), length };
+		} else {
+			if (!allowJoin) {
+				needed = frameSize;
+				return false;
+			}
+			m_joined.resize(length);
+			copyOut(start, m_joined.data(), length);
+			message = { m_joined.data(), length };
+		}
+		return true;
+	}
+
+	void framedSocket::send(const uint8_t* data, size_t len, int flags) {
+		constBuffer part = { data, len };
+		send(&part, 1, flags);
+	}
+	void framedSocket::send(const std::vector<uint8_t>& message, int flags) {
+		send(message.data(), message.size(), flags);
+	}
+	void framedSocket::send(const constBuffer* parts, size_t count, int flags) {
+		uint64_t length = 0;
+		for (size_t i = 0; i < count; i++) {
+			length += parts[i].size;
+		}
+		if (m_prefix != prefixVarint && m_prefix < 8 && length >> (8 * m_prefix) != 0) {
+			throw sysErr(EMSGSIZE); //Does not fit the header
+		}
+		uint8_t header[maxHeaderSize];
+		constBuffer local[8];
+		std::vector<constBuffer> extended;
+		constBuffer* gathered = local;
+		if (count + 1 > 8) {
+			extended.resize(count + 1);
+			gathered = extended.data();
+		}
+		gathered[0] = { header, encodeHeader(length, header) };
+		for (size_t i = 0; i < count; i++) {
+			gathered[i + 1] = parts[i];
+		}
+		m_socket.send(gathered, count + 1, flags);
+	}
+	void framedSocket::sendMany(const constBuffer* messages, size_t count, int flags) {
+		m_headers.resize(count * maxHeaderSize);
+		m_parts.resize(count * 2);
+		for (size_t i = 0; i < count; i++) {
+			if (m_prefix != prefixVarint && m_prefix < 8 && (uint64_t)messages[i].size >> (8 * m_prefix) != 0) {
+				throw sysErr(EMSGSIZE);
+			}
+			uint8_t* header = m_headers.data() + i * maxHeaderSize;
+			m_parts[i * 2] = { header, encodeHeader(messages[i].size, header) };
+			m_parts[i * 2 + 1] = messages[i];
+		}
+		m_socket.send(m_parts.data(), m_parts.size(), flags);
+	}
+
+	bool framedSocket::receive(constBuffer& message, int flags) {
+		if (m_consumeOnNext > 0) {
+			m_reader.consume(m_consumeOnNext);
+			m_consumeOnNext = 0;
+		}
+		while (true) {
+			size_t frameSize;
+			size_t needed;
+			if (parse(0, message, frameSize, needed)) {
+				m_consumeOnNext = frameSize;
+				return true;
+			}
+			if (!m_reader.fillUntil(needed, flags)) {
+				return false;
+			}
+		}
+	}
+	size_t framedSocket::receiveMany(constBuffer* messages, size_t maxCount, int flags) {
+		if (maxCount == 0) {
+			return 0;
+		}
+		if (!receive(messages[0], flags)) {
+			return 0;
+		}
+		//Everything else that arrived with it, without another system call
+		//Only one wrapped message can be joined at a time, so a second one waits for the next call
+		bool joined = !m_joined.empty() && messages[0].data == m_joined.data();
+		size_t count = 1;
+		while (count < maxCount) {
+			size_t frameSize;
+			size_t needed;
+			if (!parse(m_consumeOnNext, messages[count], frameSize, needed, !joined)) {
+				break;
+			}
+			joined = joined || (!m_joined.empty() && messages[count].data == m_joined.data());
+			m_consumeOnNext += frameSize;
+			count++;
+		}
+		return count;
+	}
+	bool framedSocket::next(constBuffer& message) {
+		if (m_consumeOnNext > 0) {
+			m_reader.consume(m_consumeOnNext);
+			m_consumeOnNext = 0;
+		}
+		size_t frameSize;
+		size_t needed;
+		if (!parse(0, message, frameSize, needed)) {
+			return false;
+		}
+		m_consumeOnNext = frameSize;
+		return true;
+	}
+
+	socket& framedSocket::sock() {
+		return m_socket;
+	}
+	size_t framedSocket::buffered() const {
+		return m_reader.available() - m_consumeOnNext;
+	}
+};
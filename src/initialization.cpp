@@ -6,34 +6,51 @@ extern "C" {
 		#include <winsock2.h>
 	#endif
 }
+#include <atomic>
+#include <mutex>
 
 namespace sks {
 	bool autoInitialize = true;
-	static size_t libraryUsers = 0;
 
-	void initialize() {
-		if (libraryUsers == 0) {
-			#ifdef __SKS_AS_WINDOWS__
+	#ifdef __SKS_AS_WINDOWS__
+		static std::atomic<size_t> libraryUsers(0);
+		static std::mutex transitionLock; //Held while WinSock is started or cleaned up
+
+		void initialize() {
+			//Already started, just take a reference
+			size_t users = libraryUsers.load();
+			while (users > 0) {
+				if (libraryUsers.compare_exchange_weak(users, users + 1)) {
+					return;
+				}
+			}
+			std::lock_guard<std::mutex> guard(transitionLock);
+			if (libraryUsers.load() == 0) {
 				// Initialize Winsock
 				WSADATA wsaData;
 				int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData); //Initialize version 2.2
 				if (iResult != 0) {
 					throw sysErr(iResult);
 				}
-			#endif
+			}
+			libraryUsers++;
 		}
-		libraryUsers++;
-	}
-	void deinitialize() {
-		libraryUsers--;
-		if (libraryUsers == 0) {
-			#ifdef __SKS_AS_WINDOWS__
+		void deinitialize() {
+			//Not the last reference, just drop it
+			size_t users = libraryUsers.load();
+			while (users > 1) {
+				if (libraryUsers.compare_exchange_weak(users, users - 1)) {
+					return;
+				}
+			}
+			std::lock_guard<std::mutex> guard(transitionLock);
+			if (--libraryUsers == 0) {
 				//Clean up Winsock
 				int e = WSACleanup();
 				if (e != 0) {
 					throw sysErr(WSAGetLastError());
 				}
-			#endif
+			}
 		}
-	}
+	#endif
 };
@@ -0,0 +1,773 @@
+#include "ioRing.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/socket.h> //accept(...), accept4(...), recv(...), send(...), connect(...)
+		#include <unistd.h> //close(...)
+		#include <poll.h> //poll(...)
+		#include <fcntl.h> //fcntl(...)
+		#ifdef __SKS_HAS_IO_URING__
+			#include <linux/io_uring.h>
+			#include <sys/syscall.h> //syscall(...) and __NR_io_uring_*
+			#include <sys/mman.h> //mmap(...)
+		#endif
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h> //WinSock 2
+
+		#define MSG_NOSIGNAL 0 //Windows does not have this flag, and instead has SO_NOSIGPIPE
+		#define MSG_DONTWAIT 0 //Nor this one; sends only run once poll(...) reports the socket writable
+		#define poll WSAPoll
+		#define POLLIN POLLRDNORM
+		#define POLLOUT POLLWRNORM
+		#define ssize_t int
+		#define errno WSAGetLastError() //Acceptable, but only if reading socket errors, per https://docs.microsoft.com/en-us/windows/win32/winsock/error-codes-errno-h-errno-and-wsagetlasterror-2
+	#endif
+}
+#include <cstring>
+#include <algorithm>
+
+namespace sks {
+	static int closeFD(int fd) {
+		#ifdef __SKS_AS_POSIX__
+			return ::close(fd);
+		#else
+			return closesocket(fd);
+		#endif
+	}
+	#ifdef __SKS_AS_POSIX__
+		static bool wouldBlock(int e) {
+			return e == EAGAIN || e == EWOULDBLOCK;
+		}
+		static bool connectPending(int e) {
+			return e == EINPROGRESS;
+		}
+	#elif defined __SKS_AS_WINDOWS__
+		static bool wouldBlock(int e) {
+			return e == WSAEWOULDBLOCK;
+		}
+		static bool connectPending(int e) {
+			return e == WSAEWOULDBLOCK;
+		}
+	#endif
+	static int setNonBlocking(int fd, bool enable) {
+		#ifdef __SKS_AS_POSIX__
+			int fileFlags = fcntl(fd, F_GETFL);
+			if (fileFlags == -1) {
+				return -1;
+			}
+			return fcntl(fd, F_SETFL, enable ? fileFlags | O_NONBLOCK : fileFlags & ~O_NONBLOCK);
+		#elif defined __SKS_AS_WINDOWS__
+			u_long mode = enable ? 1 : 0;
+			return ioctlsocket(fd, FIONBIO, &mode) == 0 ? 0 : -1;
+		#endif
+	}
+
+	#ifdef __SKS_HAS_IO_URING__
+		static const uint64_t timeoutUserData = ~(uint64_t)0; //Marks the internal timeout used by reap(...)
+
+		static int ringSetup(unsigned entries, io_uring_params* p) {
+			return syscall(__NR_io_uring_setup, entries, p);
+		}
+		static int ringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+			return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+		}
+		static int ringRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+			return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+		}
+
+		struct ioRing::kernelRing {
+			int fd = -1;
+			void* sqRing = MAP_FAILED;
+			size_t sqRingSize = 0;
+			void* cqRing = MAP_FAILED;
+			size_t cqRingSize = 0;
+			io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+			size_t sqesSize = 0;
+
+			unsigned* sqHead;
+			unsigned* sqTail;
+			unsigned* sqArray;
+			unsigned sqMask;
+			unsigned sqEntries;
+			unsigned* cqHead;
+			unsigned* cqTail;
+			io_uring_cqe* cqes;
+			unsigned cqMask;
+
+			unsigned sqeTail = 0; //Local tail, published to the kernel by enter(...)
+			unsigned pending = 0; //Prepared but not yet consumed by the kernel
+			__kernel_timespec timeout;
+
+			//Provided buffer ring; io_uring_buf_ring is not used directly since its flexible array is misplaced when compiled as C++
+			//The ring's tail overlays the first entry's resv field
+			io_uring_buf* bufRing = (io_uring_buf*)MAP_FAILED;
+			size_t bufRingSize = 0;
+			unsigned bufRingMask = 0;
+
+			~kernelRing() {
+				if (bufRing != MAP_FAILED) {
+					munmap(bufRing, bufRingSize);
+				}
+				if (sqes != MAP_FAILED) {
+					munmap(sqes, sqesSize);
+				}
+				if (cqRing != MAP_FAILED && cqRing != sqRing) {
+					munmap(cqRing, cqRingSize);
+				}
+				if (sqRing != MAP_FAILED) {
+					munmap(sqRing, sqRingSize);
+				}
+				if (fd != -1) {
+					::close(fd); //In-flight operations are cancelled by the kernel
+				}
+			}
+
+			void map(const io_uring_params& p) {
+				sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+				cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+				bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+				if (single) {
+					sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+				}
+				sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+				if (sqRing == MAP_FAILED) {
+					throw sysErr(errno);
+				}
+				if (single) {
+					cqRing = sqRing;
+				} else {
+					cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+					if (cqRing == MAP_FAILED) {
+						throw sysErr(errno);
+					}
+				}
+				sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+				sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+				if (sqes == MAP_FAILED) {
+					throw sysErr(errno);
+				}
+
+				uint8_t* sq = (uint8_t*)sqRing;
+				sqHead = (unsigned*)(sq + p.sq_off.head);
+				sqTail = (unsigned*)(sq + p.sq_off.tail);
+				sqArray = (unsigned*)(sq + p.sq_off.array);
+				sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+				sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+				uint8_t* cq = (uint8_t*)cqRing;
+				cqHead = (unsigned*)(cq + p.cq_off.head);
+				cqTail = (unsigned*)(cq + p.cq_off.tail);
+				cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+				cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+				sqeTail = *sqTail;
+			}
+
+			//Submit everything prepared, optionally waiting for minComplete completions
+			int enter(unsigned minComplete, unsigned flags) {
+				__atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+				int r = ringEnter(fd, pending, minComplete, flags);
+				if (r > 0) {
+					pending -= r;
+				}
+				return r;
+			}
+
+			io_uring_sqe* nextSqe() {
+				unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+				if (sqeTail - head >= sqEntries) {
+					//Queue is full, hand what we have to the kernel first
+					if (enter(0, 0) == -1) {
+						throw sysErr(errno);
+					}
+					head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+					if (sqeTail - head >= sqEntries) {
+						throw sysErr(EBUSY);
+					}
+				}
+				unsigned index = sqeTail & sqMask;
+				io_uring_sqe* sqe = &sqes[index];
+				memset(sqe, 0, sizeof(*sqe));
+				sqArray[index] = index;
+				sqeTail++;
+				pending++;
+				return sqe;
+			}
+
+			void addBuffer(uint8_t* buf, unsigned len, uint16_t bid, unsigned offset) {
+				io_uring_buf* b = &bufRing[(bufRing[0].resv + offset) & bufRingMask];
+				b->addr = (uint64_t)(uintptr_t)buf;
+				b->len = len;
+				b->bid = bid;
+			}
+			void advanceBuffers(unsigned count) {
+				__atomic_store_n(&bufRing[0].resv, (uint16_t)(bufRing[0].resv + count), __ATOMIC_RELEASE);
+			}
+		};
+	#else
+		struct ioRing::kernelRing {}; //Never instantiated without io_uring
+	#endif
+
+	ioRing::ioRing(unsigned entries, unsigned fixedFiles, bool allowIoUring) {
+		#ifdef __SKS_HAS_IO_URING__
+			if (allowIoUring && supported()) {
+				std::unique_ptr<kernelRing> ring(new kernelRing());
+				io_uring_params p;
+				memset(&p, 0, sizeof(p));
+				ring->fd = ringSetup(entries, &p);
+				if (ring->fd != -1) {
+					ring->map(p);
+					if (fixedFiles > 0) {
+						//Sparse file table, slots are filled by registerSocket(...)
+						std::vector<int> fds(fixedFiles, -1);
+						if (ringRegister(ring->fd, IORING_REGISTER_FILES, fds.data(), fixedFiles) == -1) {
+							fixedFiles = 0; //Not supported by this kernel, operations use plain fds
+						}
+					}
+					m_ring = std::move(ring);
+				}
+				//On failure, silently use the fallback
+			}
+		#endif
+		for (unsigned i = fixedFiles; i > 0; i--) {
+			m_freeFixedFiles.push_back(i - 1);
+		}
+	}
+	ioRing::~ioRing() {
+		for (auto& entry : m_fixedFiles) {
+			entry.second.owner->m_ring = nullptr; //The ring's file table goes with it
+		}
+	}
+
+	bool ioRing::supported() {
+		#ifdef __SKS_HAS_IO_URING__
+			//io_uring may be compiled in but unavailable at runtime (old kernel, seccomp, io_uring_disabled sysctl)
+			static const bool usable = []() -> bool {
+				io_uring_params p;
+				memset(&p, 0, sizeof(p));
+				int fd = ringSetup(1, &p);
+				if (fd == -1) {
+					return false;
+				}
+				::close(fd);
+				return true;
+			}();
+			return usable;
+		#else
+			return false;
+		#endif
+	}
+	bool ioRing::usingIoUring() const {
+		return m_ring != nullptr;
+	}
+
+	unsigned ioRing::registerSocket(const socket& s) {
+		int fd = s.socketFD();
+		auto existing = m_fixedFiles.find(fd);
+		if (existing != m_fixedFiles.end()) {
+			if (existing->second.owner != &s) {
+				throw sysErr(EEXIST); //fd number is still registered for a socket which gave it away (socketFD(true))
+			}
+			return existing->second.index;
+		}
+		if (s.m_ring != nullptr) {
+			throw sysErr(EBUSY); //Registered with another ring
+		}
+		if (m_freeFixedFiles.empty()) {
+			throw sysErr(ENFILE); //No free slots
+		}
+		unsigned index = m_freeFixedFiles.back();
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				io_uring_files_update update;
+				memset(&update, 0, sizeof(update));
+				update.offset = index;
+				update.fds = (uint64_t)(uintptr_t)&fd;
+				if (ringRegister(m_ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1) {
+					throw sysErr(errno);
+				}
+			}
+		#endif
+		m_freeFixedFiles.pop_back();
+		m_fixedFiles[fd] = { index, &s };
+		s.m_ring = this;
+		return index;
+	}
+	void ioRing::unregisterSocket(const socket& s) {
+		auto it = m_fixedFiles.find(s.socketFD());
+		if (it == m_fixedFiles.end() || it->second.owner != &s) {
+			return;
+		}
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				int fd = -1;
+				io_uring_files_update update;
+				memset(&update, 0, sizeof(update));
+				update.offset = it->second.index;
+				update.fds = (uint64_t)(uintptr_t)&fd;
+				if (ringRegister(m_ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1) {
+					throw sysErr(errno);
+				}
+			}
+		#endif
+		m_freeFixedFiles.push_back(it->second.index);
+		m_fixedFiles.erase(it);
+		s.m_ring = nullptr;
+	}
+	void ioRing::forget(const socket& s) noexcept {
+		try {
+			unregisterSocket(s);
+		} catch (...) {} //Called from socket's deconstructor
+		s.m_ring = nullptr;
+	}
+	void ioRing::moved(const socket& s) {
+		auto it = m_fixedFiles.find(s.socketFD());
+		if (it != m_fixedFiles.end()) {
+			it->second.owner = &s;
+		}
+	}
+
+	void ioRing::provideBuffers(size_t count, size_t size) {
+		if (m_bufferSize != 0) {
+			throw sysErr(EEXIST); //Buffers were already provided
+		}
+		if (count == 0 || count > 0x8000 || (count & (count - 1)) != 0 || size == 0) {
+			throw sysErr(EINVAL); //Count must be a power of two (kernel limit of 32768)
+		}
+		m_bufferMemory.resize(count * size);
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				kernelRing& ring = *m_ring;
+				ring.bufRingSize = count * sizeof(io_uring_buf);
+				ring.bufRing = (io_uring_buf*)mmap(nullptr, ring.bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (ring.bufRing == MAP_FAILED) {
+					throw sysErr(errno);
+				}
+				io_uring_buf_reg reg;
+				memset(&reg, 0, sizeof(reg));
+				reg.ring_addr = (uint64_t)(uintptr_t)ring.bufRing;
+				reg.ring_entries = count;
+				reg.bgid = 0;
+				if (ringRegister(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+					int e = errno;
+					munmap(ring.bufRing, ring.bufRingSize);
+					ring.bufRing = (io_uring_buf*)MAP_FAILED;
+					m_bufferMemory.clear();
+					throw sysErr(e);
+				}
+				ring.bufRingMask = count - 1;
+				ring.bufRing[0].resv = 0; //Tail
+				for (size_t i = 0; i < count; i++) {
+					ring.addBuffer(m_bufferMemory.data() + i * size, size, i, i);
+				}
+				ring.advanceBuffers(count);
+			}
+		#endif
+		if (!m_ring) {
+			for (size_t i = count; i > 0; i--) {
+				m_freeBuffers.push_back(i - 1);
+			}
+		}
+		m_bufferSize = size;
+	}
+	uint8_t* ioRing::buffer(int bufferId) {
+		return m_bufferMemory.data() + bufferId * m_bufferSize;
+	}
+	void ioRing::recycleBuffer(int bufferId) {
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				m_ring->addBuffer(buffer(bufferId), m_bufferSize, bufferId, 0);
+				m_ring->advanceBuffers(1);
+				return;
+			}
+		#endif
+		m_freeBuffers.push_back(bufferId);
+	}
+
+	size_t ioRing::prepare(const operation& op) {
+		size_t index;
+		if (m_freeOperations.empty()) {
+			index = m_operations.size();
+			m_operations.push_back(op);
+		} else {
+			index = m_freeOperations.back();
+			m_freeOperations.pop_back();
+			m_operations[index] = op;
+		}
+		operation& o = m_operations[index];
+
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				io_uring_sqe* sqe;
+				try {
+					sqe = m_ring->nextSqe();
+				} catch (...) {
+					m_freeOperations.push_back(index);
+					throw;
+				}
+				sqe->user_data = index;
+				auto fixed = m_fixedFiles.find(o.fd);
+				if (fixed != m_fixedFiles.end() && o.op != ioClose) {
+					sqe->fd = fixed->second.index;
+					sqe->flags |= IOSQE_FIXED_FILE;
+				} else {
+					sqe->fd = o.fd;
+				}
+				switch (o.op) {
+					case ioAccept:
+						sqe->opcode = IORING_OP_ACCEPT;
+						sqe->accept_flags = SOCK_CLOEXEC;
+						if (o.multishot) {
+							sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+						}
+						break;
+					case ioReceive:
+						sqe->opcode = IORING_OP_RECV;
+						sqe->msg_flags = o.flags;
+						if (o.bufferSelect) {
+							sqe->flags |= IOSQE_BUFFER_SELECT;
+							sqe->buf_group = 0;
+							sqe->len = o.multishot ? 0 : m_bufferSize; //0 lets multishot use each buffer's full length
+							if (o.multishot) {
+								sqe->ioprio |= IORING_RECV_MULTISHOT;
+							}
+						} else {
+							sqe->addr = (uint64_t)(uintptr_t)o.buf;
+							sqe->len = o.len;
+						}
+						break;
+					case ioSend:
+						sqe->opcode = IORING_OP_SEND;
+						sqe->addr = (uint64_t)(uintptr_t)o.buf;
+						sqe->len = o.len;
+						sqe->msg_flags = o.flags | MSG_NOSIGNAL | MSG_WAITALL; //Retry partial sends like socket::send(...)
+						break;
+					case ioConnect:
+						sqe->opcode = IORING_OP_CONNECT;
+						sqe->addr = (uint64_t)(uintptr_t)&o.addr;
+						sqe->off = o.addrLen;
+						break;
+					case ioClose:
+						sqe->opcode = IORING_OP_CLOSE;
+						break;
+				}
+				return index;
+			}
+		#endif
+		m_queued.push_back(index);
+		m_prepared++;
+		return index;
+	}
+
+	bool ioRing::runOperation(size_t index) {
+		operation& op = m_operations[index];
+		ioCompletion c = { op.tag, op.op, 0, -1, false };
+		switch (op.op) {
+			case ioAccept:
+				{
+					#ifdef __SKS_AS_LINUX__
+						int fd = accept4(op.fd, nullptr, nullptr, SOCK_CLOEXEC); //Same as the io_uring path
+					#else
+						int fd = ::accept(op.fd, nullptr, nullptr);
+					#endif
+					c.result = fd == -1 ? -errno : fd;
+				}
+				break;
+			case ioReceive:
+				{
+					uint8_t* buf = op.buf;
+					size_t len = op.len;
+					if (op.bufferSelect) {
+						if (m_freeBuffers.empty()) {
+							c.result = -ENOBUFS;
+							break;
+						}
+						c.bufferId = m_freeBuffers.back();
+						m_freeBuffers.pop_back();
+						buf = buffer(c.bufferId);
+						len = m_bufferSize;
+					}
+					ssize_t r = recv(op.fd, (char*)buf, len, op.flags | MSG_NOSIGNAL);
+					if (r == -1) {
+						c.result = -errno;
+						if (c.bufferId != -1) {
+							m_freeBuffers.push_back(c.bufferId);
+							c.bufferId = -1;
+						}
+					} else {
+						c.result = r;
+					}
+				}
+				break;
+			case ioSend:
+				{
+					//One send per readiness report, whatever is left waits for the next one
+					ssize_t r = ::send(op.fd, (const char*)op.buf + op.sent, op.len - op.sent, op.flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+					if (r == -1) {
+						int e = errno;
+						if (wouldBlock(e)) {
+							return true;
+						}
+						c.result = -e;
+						break;
+					}
+					op.sent += r;
+					if (op.sent < op.len) {
+						return true;
+					}
+					c.result = op.sent;
+				}
+				break;
+			case ioConnect:
+				if (op.connecting) {
+					//Writable, so the connect has finished one way or the other
+					int e = 0;
+					socklen_t len = sizeof(e);
+					if (getsockopt(op.fd, SOL_SOCKET, SO_ERROR, (char*)&e, &len) == -1) {
+						e = errno;
+					}
+					c.result = -e;
+				} else {
+					//connect has no per-call flag, so a blocking socket is non-blocking only while starting the connect
+					if (!op.nonBlocking && setNonBlocking(op.fd, true) == -1) {
+						c.result = -errno;
+						break;
+					}
+					int r = ::connect(op.fd, (sockaddr*)&op.addr, op.addrLen);
+					int e = errno;
+					if (!op.nonBlocking) {
+						setNonBlocking(op.fd, false);
+					}
+					if (r == -1) {
+						if (connectPending(e)) {
+							op.connecting = true;
+							return true;
+						}
+						c.result = -e;
+					}
+				}
+				break;
+			case ioClose:
+				if (closeFD(op.fd) == -1) {
+					c.result = -errno;
+				}
+				break;
+		}
+		//Multishot operations stay armed until they fail (or a receive reaches end-of-stream)
+		c.more = op.multishot && c.result > 0;
+		if (op.op == ioAccept) {
+			c.more = op.multishot && c.result >= 0;
+		}
+		m_completed.push_back(c);
+		if (!c.more) {
+			m_freeOperations.push_back(index);
+		}
+		return c.more;
+	}
+	void ioRing::runQueued(std::chrono::milliseconds timeout) {
+		//Only run operations which won't block, so one operation can never stall another (e.g. a receive waiting on a later send)
+		m_pollStructs.resize(m_queued.size());
+		bool immediate = false;
+		for (size_t i = 0; i < m_queued.size(); i++) {
+			const operation& op = m_operations[m_queued[i]];
+			pollfd& pfd = m_pollStructs[i];
+			pfd.fd = op.fd;
+			pfd.revents = 0;
+			switch (op.op) {
+				case ioAccept:
+				case ioReceive:
+					pfd.events = POLLIN;
+					break;
+				case ioSend:
+					pfd.events = POLLOUT;
+					break;
+				case ioConnect:
+					if (op.connecting) {
+						pfd.events = POLLOUT;
+						break;
+					}
+					//Starting it does not wait
+					pfd.events = 0;
+					pfd.fd = -1;
+					immediate = true;
+					break;
+				default:
+					pfd.events = 0; //Close is run as-is
+					pfd.fd = -1;
+					immediate = true;
+					break;
+			}
+		}
+		int timeoutMs = timeout.count() < 0 ? -1 : (int)timeout.count();
+		if (immediate) {
+			timeoutMs = 0;
+		}
+		int r = poll(m_pollStructs.data(), m_pollStructs.size(), timeoutMs);
+		if (r == -1) {
+			if (errno == EINTR) {
+				return;
+			}
+			throw sysErr(errno);
+		}
+
+		//Run what is ready, keeping the rest (and still-armed multishots) queued in order
+		size_t kept = 0;
+		for (size_t i = 0; i < m_pollStructs.size(); i++) {
+			size_t index = m_queued[i];
+			bool ready = m_pollStructs[i].events == 0 || m_pollStructs[i].revents != 0;
+			if (!ready || runOperation(index)) {
+				m_queued[kept++] = index;
+			}
+		}
+		m_queued.resize(kept);
+	}
+
+	void ioRing::accept(const socket& listener, uint64_t tag, bool multishot) {
+		operation op = {};
+		op.tag = tag;
+		op.op = ioAccept;
+		op.fd = listener.socketFD();
+		op.multishot = multishot;
+		prepare(op);
+	}
+	void ioRing::receive(const socket& s, uint8_t* buf, size_t len, uint64_t tag, int flags) {
+		operation op = {};
+		op.tag = tag;
+		op.op = ioReceive;
+		op.fd = s.socketFD();
+		op.buf = buf;
+		op.len = len;
+		op.flags = flags;
+		prepare(op);
+	}
+	void ioRing::receive(const socket& s, uint64_t tag, bool multishot, int flags) {
+		if (m_bufferSize == 0) {
+			throw sysErr(EINVAL); //provideBuffers(...) must be called first
+		}
+		operation op = {};
+		op.tag = tag;
+		op.op = ioReceive;
+		op.fd = s.socketFD();
+		op.flags = flags;
+		op.multishot = multishot;
+		op.bufferSelect = true;
+		prepare(op);
+	}
+	void ioRing::send(const socket& s, const uint8_t* data, size_t len, uint64_t tag, int flags) {
+		operation op = {};
+		op.tag = tag;
+		op.op = ioSend;
+		op.fd = s.socketFD();
+		op.buf = (uint8_t*)data;
+		op.len = len;
+		op.flags = flags;
+		prepare(op);
+	}
+	void ioRing::connect(const socket& s, const address& to, uint64_t tag) {
+		operation op = {};
+		op.tag = tag;
+		op.op = ioConnect;
+		op.fd = s.socketFD();
+		op.addr = to;
+		op.addrLen = to.size();
+		op.nonBlocking = s.m_nonBlocking;
+		prepare(op);
+	}
+	void ioRing::close(socket& s, uint64_t tag) {
+		unregisterSocket(s);
+		operation op = {};
+		op.tag = tag;
+		op.op = ioClose;
+		op.fd = s.socketFD(true); //The socket no longer closes its fd, we do
+		prepare(op);
+	}
+
+	size_t ioRing::submit() {
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				if (m_ring->pending == 0) {
+					return 0;
+				}
+				int r = m_ring->enter(0, 0);
+				if (r == -1) {
+					throw sysErr(errno);
+				}
+				return r;
+			}
+		#endif
+		size_t count = m_prepared;
+		m_prepared = 0;
+		runQueued(std::chrono::milliseconds(0));
+		return count;
+	}
+
+	size_t ioRing::reap(ioCompletion* results, size_t capacity, std::chrono::milliseconds timeout) {
+		#ifdef __SKS_HAS_IO_URING__
+			if (m_ring) {
+				kernelRing& ring = *m_ring;
+				auto harvest = [&]() -> size_t {
+					size_t n = 0;
+					unsigned head = *ring.cqHead; //Only we move the head
+					unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+					while (head != tail && n < capacity) {
+						const io_uring_cqe& cqe = ring.cqes[head & ring.cqMask];
+						head++;
+						if (cqe.user_data == timeoutUserData) {
+							continue;
+						}
+						size_t index = cqe.user_data;
+						ioCompletion& c = results[n++];
+						c.tag = m_operations[index].tag;
+						c.operation = m_operations[index].op;
+						c.result = cqe.res;
+						c.bufferId = (cqe.flags & IORING_CQE_F_BUFFER) ? (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+						c.more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+						if (!c.more) {
+							m_freeOperations.push_back(index);
+						}
+					}
+					__atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+					return n;
+				};
+
+				size_t n = harvest();
+				if (n == 0 && capacity > 0 && timeout.count() != 0) {
+					if (timeout.count() > 0) {
+						//Timeout which also completes as soon as one other completion arrives
+						ring.timeout.tv_sec = timeout.count() / 1000;
+						ring.timeout.tv_nsec = (timeout.count() % 1000) * 1000000;
+						io_uring_sqe* sqe = ring.nextSqe();
+						sqe->opcode = IORING_OP_TIMEOUT;
+						sqe->fd = -1;
+						sqe->addr = (uint64_t)(uintptr_t)&ring.timeout;
+						sqe->len = 1;
+						sqe->off = 1;
+						sqe->user_data = timeoutUserData;
+					}
+					int r = ring.enter(1, IORING_ENTER_GETEVENTS);
+					if (r == -1 && errno != EINTR && errno != ETIME) {
+						throw sysErr(errno);
+					}
+					n = harvest();
+				} else if (ring.pending > 0) {
+					//Don't leave prepared operations sitting in the queue
+					ring.enter(0, 0);
+				}
+				return n;
+			}
+		#endif
+		if (m_completed.empty() && !m_queued.empty()) {
+			m_prepared = 0; //Counts as submitted
+			runQueued(timeout);
+		}
+		size_t n = 0;
+		while (n < capacity && !m_completed.empty()) {
+			results[n++] = m_completed.front();
+			m_completed.pop_front();
+		}
+		return n;
+	}
+
+	socket ioRing::acceptedSocket(const socket& listener, int fd) const {
+		return socket(fd, listener.m_domain, listener.m_type, listener.m_protocol);
+	}
+};
@@ -0,0 +1,92 @@
+#include "listenerGroup.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_LINUX__
+		#include <sys/socket.h> //setsockopt(...)
+		#include <linux/filter.h> //sock_filter and sock_fprog
+	#endif
+}
+#include <thread>
+#include <stdexcept>
+
+namespace sks {
+	listenerGroup::listenerGroup(const address& at, type t, size_t members, bool steerByCPU, int backlog, int protocol) {
+		#ifndef SO_REUSEPORT
+			throw std::runtime_error("listenerGroup is not implemented for windows systems.");
+		#else
+			size_t cpus = std::thread::hardware_concurrency();
+			if (members == 0) {
+				members = cpus > 0 ? cpus : 1;
+			}
+			if (steerByCPU && cpus > 0 && members > cpus) {
+				members = cpus; //Steering only ever picks members 0 to cpus - 1, the rest would never get traffic
+			}
+			m_address = at;
+			m_members.reserve(members);
+			for (size_t i = 0; i < members; i++) {
+				m_members.emplace_back(at.addressDomain(), t, protocol);
+				socket& member = m_members.back();
+				member.socketOption(reusePort, true); //Must be set on every member before it is bound
+				member.socketOption(reuseAddr, true); //Rebinding while old connections linger in TIME_WAIT
+				member.bind(m_address);
+				if (i == 0) {
+					m_address = member.localAddress(); //Fills in a system-picked port for the rest
+				}
+			}
+			if (steerByCPU) {
+				steer();
+			}
+			//Only listen once the group is complete (and steered), so no connection is queued to a member the program would not have chosen
+			if (t == stream || t == seq) {
+				for (socket& member : m_members) {
+					member.listen(backlog);
+				}
+			}
+		#endif
+	}
+
+	void listenerGroup::steer() {
+		#ifdef __SKS_AS_LINUX__
+			//A = CPU the packet arrived on, returned modulo the member count as the index of the member to deliver to
+			sock_filter code[] = {
+				{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+				{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)m_members.size() },
+				{ BPF_RET | BPF_A, 0, 0, 0 },
+			};
+			sock_fprog program;
+			program.len = sizeof(code) / sizeof(code[0]);
+			program.filter = code;
+			//Attaching to any member applies to the whole group
+			if (setsockopt(m_members.front().socketFD(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+				throw sysErr(errno);
+			}
+			m_steered = true;
+		#else
+			throw std::runtime_error("listenerGroup CPU steering is only implemented for linux systems.");
+		#endif
+	}
+
+	size_t listenerGroup::size() const {
+		return m_members.size();
+	}
+	socket& listenerGroup::operator[](size_t index) {
+		return m_members[index];
+	}
+	const socket& listenerGroup::operator[](size_t index) const {
+		return m_members[index];
+	}
+	std::vector<socket>::iterator listenerGroup::begin() {
+		return m_members.begin();
+	}
+	std::vector<socket>::iterator listenerGroup::end() {
+		return m_members.end();
+	}
+
+	const address& listenerGroup::localAddress() const {
+		return m_address;
+	}
+	bool listenerGroup::steered() const {
+		return m_steered;
+	}
+};
@@ -0,0 +1,220 @@
+#include "pollSet.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <poll.h> //poll(...)
+		#include <unistd.h> //close(...)
+		#ifdef __SKS_HAS_EPOLL__
+			#include <sys/epoll.h> //epoll_*(...)
+		#endif
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h> //WinSock 2
+
+		#define poll WSAPoll
+		#define POLLIN POLLRDNORM
+		#define POLLOUT POLLWRNORM
+		#define errno WSAGetLastError() //Acceptable, but only if reading socket errors, per https://docs.microsoft.com/en-us/windows/win32/winsock/error-codes-errno-h-errno-and-wsagetlasterror-2
+	#endif
+}
+
+namespace sks {
+	#ifdef __SKS_HAS_EPOLL__
+		static uint32_t toEpollEvents(int events, triggerMode mode) {
+			uint32_t e = 0;
+			if (events & readable) {
+				e |= EPOLLIN;
+			}
+			if (events & writable) {
+				e |= EPOLLOUT;
+			}
+			if (events & hangup) {
+				e |= EPOLLRDHUP; //EPOLLHUP and EPOLLERR are always reported
+			}
+			if (mode == edgeTriggered) {
+				e |= EPOLLET;
+			}
+			return e;
+		}
+		static int fromEpollEvents(uint32_t e) {
+			int events = 0;
+			if (e & EPOLLIN) {
+				events |= readable;
+			}
+			if (e & EPOLLOUT) {
+				events |= writable;
+			}
+			if (e & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				events |= hangup;
+			}
+			return events;
+		}
+	#else
+		static short toPollEvents(int events) {
+			short e = 0;
+			if (events & readable) {
+				e |= POLLIN;
+			}
+			if (events & writable) {
+				e |= POLLOUT;
+			}
+			return e; //POLLHUP and POLLERR are always reported
+		}
+		static int fromPollEvents(short e) {
+			int events = 0;
+			if (e & POLLIN) {
+				events |= readable;
+			}
+			if (e & POLLOUT) {
+				events |= writable;
+			}
+			if (e & (POLLHUP | POLLERR)) {
+				events |= hangup;
+			}
+			return events;
+		}
+	#endif
+
+	pollSet::pollSet() {
+		#ifdef __SKS_HAS_EPOLL__
+			m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+			if (m_epollFD == -1) {
+				throw sysErr(errno);
+			}
+		#endif
+	}
+	pollSet::~pollSet() {
+		#ifdef __SKS_HAS_EPOLL__
+			close(m_epollFD);
+		#endif
+	}
+
+	void pollSet::add(int fd, int events, uint64_t tag, triggerMode mode) {
+		#ifdef __SKS_HAS_EPOLL__
+			epoll_event ev;
+			ev.events = toEpollEvents(events, mode);
+			ev.data.u64 = tag;
+			int e = epoll_ctl(m_epollFD, EPOLL_CTL_ADD, fd, &ev);
+			if (e == -1) {
+				throw sysErr(errno);
+			}
+			m_fds.insert(fd); //May already be there if a registered fd was closed and its number reused
+		#else
+			//poll(...) is inherently level-triggered; edge-triggered users must still drain the socket, so behaviour is compatible
+			if (m_indices.count(fd) != 0) {
+				throw sysErr(EEXIST); //Already registered
+			}
+			pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = toPollEvents(events);
+			pfd.revents = 0;
+			m_indices[fd] = m_pollStructs.size();
+			m_pollStructs.push_back(pfd);
+			m_tags.push_back(tag);
+		#endif
+	}
+	void pollSet::add(const socket& s, int events, uint64_t tag, triggerMode mode) {
+		return add(s.socketFD(), events, tag, mode);
+	}
+	void pollSet::modify(int fd, int events, uint64_t tag, triggerMode mode) {
+		#ifdef __SKS_HAS_EPOLL__
+			epoll_event ev;
+			ev.events = toEpollEvents(events, mode);
+			ev.data.u64 = tag;
+			int e = epoll_ctl(m_epollFD, EPOLL_CTL_MOD, fd, &ev);
+			if (e == -1) {
+				throw sysErr(errno);
+			}
+		#else
+			auto it = m_indices.find(fd);
+			if (it == m_indices.end()) {
+				throw sysErr(ENOENT); //Not registered
+			}
+			m_pollStructs[it->second].events = toPollEvents(events);
+			m_tags[it->second] = tag;
+		#endif
+	}
+	void pollSet::modify(const socket& s, int events, uint64_t tag, triggerMode mode) {
+		return modify(s.socketFD(), events, tag, mode);
+	}
+	void pollSet::remove(int fd) {
+		#ifdef __SKS_HAS_EPOLL__
+			auto it = m_fds.find(fd);
+			if (it == m_fds.end()) {
+				throw sysErr(ENOENT); //Not registered
+			}
+			m_fds.erase(it);
+			epoll_event ev; //Ignored, but required non-null before Linux 2.6.9
+			int e = epoll_ctl(m_epollFD, EPOLL_CTL_DEL, fd, &ev);
+			if (e == -1 && errno != EBADF) { //EBADF: fd was already closed, which removed it from the interest list
+				throw sysErr(errno);
+			}
+		#else
+			auto it = m_indices.find(fd);
+			if (it == m_indices.end()) {
+				throw sysErr(ENOENT); //Not registered
+			}
+			//Swap-remove so removal stays constant-time
+			size_t index = it->second;
+			m_indices.erase(it);
+			if (index != m_pollStructs.size() - 1) {
+				m_pollStructs[index] = m_pollStructs.back();
+				m_tags[index] = m_tags.back();
+				m_indices[m_pollStructs[index].fd] = index;
+			}
+			m_pollStructs.pop_back();
+			m_tags.pop_back();
+		#endif
+	}
+	void pollSet::remove(const socket& s) {
+		return remove(s.socketFD());
+	}
+	size_t pollSet::size() const {
+		#ifdef __SKS_HAS_EPOLL__
+			return m_fds.size();
+		#else
+			return m_pollStructs.size();
+		#endif
+	}
+
+	size_t pollSet::wait(event* results, size_t capacity, std::chrono::milliseconds timeout) {
+		int timeoutMs = timeout.count() < 0 ? -1 : (int)timeout.count();
+		#ifdef __SKS_HAS_EPOLL__
+			if (m_events.size() < capacity) {
+				m_events.resize(capacity);
+			}
+			int r = epoll_wait(m_epollFD, m_events.data(), capacity, timeoutMs);
+			if (r == -1) {
+				if (errno == EINTR) {
+					return 0;
+				}
+				throw sysErr(errno);
+			}
+			for (int i = 0; i < r; i++) {
+				results[i].tag = m_events[i].data.u64;
+				results[i].events = fromEpollEvents(m_events[i].events);
+			}
+			return r;
+		#else
+			int r = poll(m_pollStructs.data(), m_pollStructs.size(), timeoutMs);
+			if (r == -1) {
+				if (errno == EINTR) {
+					return 0;
+				}
+				throw sysErr(errno);
+			}
+			size_t found = 0;
+			for (size_t i = 0; i < m_pollStructs.size() && found < (size_t)r; i++) {
+				if (m_pollStructs[i].revents != 0) {
+					if (found < capacity) {
+						results[found].tag = m_tags[i];
+						results[found].events = fromPollEvents(m_pollStructs[i].revents);
+					}
+					found++; //Counted (even past capacity) so the scan can stop early
+					m_pollStructs[i].revents = 0;
+				}
+			}
+			return found < capacity ? found : capacity;
+		#endif
+	}
+};
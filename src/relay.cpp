@@ -0,0 +1,191 @@
+#include "relay.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/socket.h> //recv(...), send(...) and shutdown(...)
+		#include <unistd.h> //close(...)
+		#include <poll.h> //poll(...)
+		#ifdef __SKS_AS_LINUX__
+			#include <fcntl.h> //splice(...), pipe2(...) and F_SETPIPE_SZ
+		#endif
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h> //WinSock 2
+
+		#define MSG_NOSIGNAL 0 //Windows does not have this flag, and instead has SO_NOSIGPIPE
+		#define SHUT_WR SD_SEND
+		#define poll WSAPoll
+		#define POLLIN POLLRDNORM
+		#define POLLOUT POLLWRNORM
+		#define ssize_t int
+		#define errno WSAGetLastError() //Acceptable, but only if reading socket errors, per https://docs.microsoft.com/en-us/windows/win32/winsock/error-codes-errno-h-errno-and-wsagetlasterror-2
+	#endif
+}
+
+namespace sks {
+	relay::relay(socket& a, socket& b, size_t capacity) : m_capacity(capacity > 0 ? capacity : 1) {
+		m_aToB.from = &a;
+		m_aToB.to = &b;
+		m_bToA.from = &b;
+		m_bToA.to = &a;
+		for (direction* d : { &m_aToB, &m_bToA }) {
+			#ifdef __SKS_AS_LINUX__
+				if (pipe2(d->pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+					int e = errno;
+					if (d == &m_bToA) {
+						close(m_aToB.pipe[0]);
+						close(m_aToB.pipe[1]);
+					}
+					throw sysErr(e);
+				}
+				//Best effort (limited by /proc/sys/fs/pipe-max-size), never buffer more than the pipe holds
+				fcntl(d->pipe[1], F_SETPIPE_SZ, (int)m_capacity);
+				int pipeSize = fcntl(d->pipe[1], F_GETPIPE_SZ);
+				if (pipeSize > 0 && (size_t)pipeSize < m_capacity) {
+					m_capacity = pipeSize;
+				}
+			#else
+				d->buffer.resize(m_capacity);
+			#endif
+		}
+	}
+	relay::~relay() {
+		#ifdef __SKS_AS_LINUX__
+			for (direction* d : { &m_aToB, &m_bToA }) {
+				close(d->pipe[0]);
+				close(d->pipe[1]);
+			}
+		#endif
+	}
+
+	bool relay::wantsRead(const direction& d) const {
+		#ifdef __SKS_AS_LINUX__
+			if (d.pipeFull) {
+				return false;
+			}
+		#endif
+		return !d.ended && d.buffered < m_capacity;
+	}
+	bool relay::wantsWrite(const direction& d) const {
+		return d.buffered > 0;
+	}
+	void relay::read(direction& d) {
+		#ifdef __SKS_AS_LINUX__
+			//Only called once the socket is readable, so splicing from it won't block
+			ssize_t r = splice(d.from->socketFD(), nullptr, d.pipe[1], nullptr, m_capacity - d.buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		#else
+			size_t end = (d.start + d.buffered) % m_capacity;
+			size_t space = end >= d.start ? m_capacity - end : d.start - end;
+			ssize_t r = recv(d.from->socketFD(), (char*)d.buffer.data() + end, space, MSG_NOSIGNAL);
+		#endif
+		if (r == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				#ifdef __SKS_AS_LINUX__
+					//With data in the pipe, it may have run out of slots before reaching m_capacity bytes; stop polling from until write(...) drains some
+					//An empty pipe can't be full, so that's just a spurious wakeup
+					d.pipeFull = d.buffered > 0;
+				#endif
+				return; //Nothing to read yet
+			}
+			throw sysErr(errno);
+		}
+		if (r == 0) {
+			d.ended = true; //Half-close, forwarded by finish(...) once drained
+		}
+		d.buffered += r;
+	}
+	void relay::write(direction& d) {
+		//Only called once the socket is writable, so splicing to it won't block
+		#ifdef __SKS_AS_LINUX__
+			ssize_t r = splice(d.pipe[0], nullptr, d.to->socketFD(), nullptr, d.buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		#else
+			size_t contiguous = d.start + d.buffered > m_capacity ? m_capacity - d.start : d.buffered;
+			ssize_t r = ::send(d.to->socketFD(), (const char*)d.buffer.data() + d.start, contiguous, MSG_NOSIGNAL);
+		#endif
+		if (r == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			throw sysErr(errno);
+		}
+		#ifdef __SKS_AS_LINUX__
+			if (r > 0) {
+				d.pipeFull = false;
+			}
+		#else
+			d.start = (d.start + r) % m_capacity;
+		#endif
+		d.buffered -= r;
+		d.transferred += r;
+	}
+	void relay::finish(direction& d) {
+		if (d.ended && d.buffered == 0 && !d.shutDown) {
+			if (::shutdown(d.to->socketFD(), SHUT_WR) == -1 && errno != ENOTCONN) { //ENOTCONN: Peer is already gone
+				throw sysErr(errno);
+			}
+			d.shutDown = true;
+		}
+	}
+
+	bool relay::pump(std::chrono::milliseconds timeout) {
+		//A side is polled for reading in one direction and writing in the other
+		direction* reading[2] = { &m_aToB, &m_bToA };
+		direction* writing[2] = { &m_bToA, &m_aToB };
+		pollfd pfds[2];
+		for (size_t i = 0; i < 2; i++) {
+			pfds[i].fd = reading[i]->from->socketFD();
+			pfds[i].events = 0;
+			pfds[i].revents = 0;
+			if (wantsRead(*reading[i])) {
+				pfds[i].events |= POLLIN;
+			}
+			if (wantsWrite(*writing[i])) {
+				pfds[i].events |= POLLOUT;
+			}
+			if (pfds[i].events == 0) {
+				pfds[i].fd = -1; //Nothing to do for this side, don't wake up for its hangup
+			}
+		}
+		//Forward half-closes that are already drained
+		finish(m_aToB);
+		finish(m_bToA);
+		if (finished()) {
+			return false;
+		}
+
+		int r = poll(pfds, 2, timeout.count() < 0 ? -1 : (int)timeout.count());
+		if (r == -1) {
+			if (errno == EINTR) {
+				return true;
+			}
+			throw sysErr(errno);
+		}
+		for (size_t i = 0; i < 2; i++) {
+			//Errors and hangups are reported by the call that follows
+			if ((pfds[i].events & POLLIN) && (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				read(*reading[i]);
+			}
+		}
+		for (size_t i = 0; i < 2; i++) {
+			if ((pfds[i].events & POLLOUT) && (pfds[i].revents & (POLLOUT | POLLHUP | POLLERR))) {
+				write(*writing[i]);
+			}
+		}
+		finish(m_aToB);
+		finish(m_bToA);
+		return !finished();
+	}
+	void relay::run() {
+		while (pump(std::chrono::milliseconds(-1))) {}
+	}
+	bool relay::finished() const {
+		return m_aToB.shutDown && m_bToA.shutDown;
+	}
+
+	uint64_t relay::bytesAToB() const {
+		return m_aToB.transferred;
+	}
+	uint64_t relay::bytesBToA() const {
+		return m_bToA.transferred;
+	}
+};
@@ -0,0 +1,329 @@
+#include "resolver.hpp"
+#include "errors.hpp"
+#include "initialization.hpp"
+#include <cstring>
+#include <stdexcept>
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/socket.h>
+		#include <netdb.h>
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h>
+	#endif
+}
+
+namespace sks {
+	//Copy of addr with its port replaced (IP domains only)
+	static address withPort(const address& addr, uint16_t port) {
+		sockaddr_storage storage = addr;
+		switch (addr.addressDomain()) {
+			case IPv4:
+				((sockaddr_in*)&storage)->sin_port = htons(port);
+				break;
+			case IPv6:
+				((sockaddr_in6*)&storage)->sin6_port = htons(port);
+				break;
+			default:
+				break;
+		}
+		return address(storage, addr.size());
+	}
+	static std::string cacheKey(const std::string& host, domain d) {
+		return std::to_string((int)d) + '/' + host;
+	}
+
+	resolver::resolver(lookupFunction lookup, std::chrono::milliseconds positiveTTL, std::chrono::milliseconds negativeTTL, size_t shards, size_t threads, size_t maxEntries) : m_lookup(std::move(lookup)), m_positiveTTL(positiveTTL), m_negativeTTL(negativeTTL), m_threadCount(threads > 0 ? threads : 1), m_pool(new pool()) {
+		m_shards.resize(shards > 0 ? shards : 1);
+		for (std::unique_ptr<shard>& s : m_shards) {
+			s.reset(new shard());
+		}
+		m_shardCapacity = (maxEntries + m_shards.size() - 1) / m_shards.size();
+		if (m_shardCapacity == 0) {
+			m_shardCapacity = 1;
+		}
+	}
+	resolver::~resolver() {
+		//Queued lookups still run, so every future and callback completes
+		{
+			std::lock_guard<std::mutex> guard(m_pool->lock);
+			m_pool->stopping = true;
+		}
+		m_pool->changed.notify_all();
+		for (std::thread& t : m_pool->threads) {
+			if (t.get_id() == std::this_thread::get_id()) {
+				t.detach(); //Destroyed from a callback, this thread can't join itself; it exits once the callback returns
+			} else {
+				t.join();
+			}
+		}
+		//Only left over if this is a pool thread, the others drain the queue before exiting
+		std::unique_lock<std::mutex> guard(m_pool->lock);
+		while (!m_pool->tasks.empty()) {
+			std::function<void()> task = std::move(m_pool->tasks.front());
+			m_pool->tasks.pop_front();
+			guard.unlock();
+			task();
+			guard.lock();
+		}
+	}
+
+	resolver::shard& resolver::shardFor(const std::string& key) {
+		return *m_shards[std::hash<std::string>()(key) % m_shards.size()];
+	}
+	std::shared_ptr<const resolver::result> resolver::cached(const std::string& key) {
+		shard& s = shardFor(key);
+		std::lock_guard<std::mutex> guard(s.lock);
+		auto it = s.entries.find(key);
+		if (it == s.entries.end() || it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return nullptr;
+		}
+		std::shared_ptr<const result> r = it->second.get();
+		return r->expires > clock::now() ? r : nullptr;
+	}
+	std::shared_ptr<const resolver::result> resolver::lookup(const std::string& host, domain d) {
+		std::string key = cacheKey(host, d);
+		shard& s = shardFor(key);
+
+		std::unique_lock<std::mutex> guard(s.lock);
+		auto it = s.entries.find(key);
+		if (it != s.entries.end()) {
+			pendingResult pending = it->second;
+			if (pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				//Someone else is resolving this name, share their result
+				guard.unlock();
+				return pending.get();
+			}
+			if (pending.get()->expires > clock::now()) {
+				return pending.get();
+			}
+		}
+		if (it == s.entries.end()) {
+			makeRoom(s);
+		}
+		std::promise<std::shared_ptr<const result>> promise;
+		s.entries[key] = promise.get_future().share();
+		guard.unlock();
+
+		//Resolve outside of the lock, waiters hold the shared future
+		std::shared_ptr<result> r(new result());
+		try {
+			r->addresses = m_lookup(host, d);
+			if (r->addresses.empty()) {
+				throw std::runtime_error("Could not resolve " + host);
+			}
+		} catch (...) {
+			r->addresses.clear();
+			r->error = std::current_exception();
+		}
+		r->expires = clock::now() + (r->error ? m_negativeTTL : m_positiveTTL);
+		promise.set_value(r);
+		return r;
+	}
+
+	bool resolver::expired(const pendingResult& pending, clock::time_point now) {
+		return pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready && pending.get()->expires <= now;
+	}
+	void resolver::makeRoom(shard& s) {
+		//Sweeping walks the whole shard, so it only happens once the shard has grown (or is full)
+		if (s.entries.size() < s.sweepAt && s.entries.size() < m_shardCapacity) {
+			return;
+		}
+		clock::time_point now = clock::now();
+		auto soonest = s.entries.end();
+		for (auto it = s.entries.begin(); it != s.entries.end();) {
+			if (expired(it->second, now)) {
+				it = s.entries.erase(it);
+				continue;
+			}
+			if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready && (soonest == s.entries.end() || it->second.get()->expires < soonest->second.get()->expires)) {
+				soonest = it;
+			}
+			++it;
+		}
+		if (s.entries.size() >= m_shardCapacity && soonest != s.entries.end()) {
+			s.entries.erase(soonest); //Lookups in progress are never evicted, their waiters still get the result
+		}
+		s.sweepAt = s.entries.size() * 2 > 16 ? s.entries.size() * 2 : 16;
+	}
+
+	void resolver::splitHostPort(const std::string& addrstr, std::string& host, uint16_t& port) const {
+		host = addrstr;
+		unsigned long p = 0;
+		size_t colonIndex = addrstr.find(':');
+		if (!addrstr.empty() && addrstr[0] == '[') {
+			size_t cbIndex = addrstr.find(']');
+			if (cbIndex == std::string::npos) {
+				throw std::runtime_error("Could not parse string to address: " + addrstr);
+			}
+			host = addrstr.substr(1, cbIndex - 1);
+			if (cbIndex + 1 < addrstr.size()) {
+				if (addrstr[cbIndex + 1] != ':') {
+					throw std::runtime_error("Could not parse string to address: " + addrstr);
+				}
+				p = std::stoul(addrstr.substr(cbIndex + 2));
+			}
+		} else if (colonIndex != std::string::npos && addrstr.find(':', colonIndex + 1) == std::string::npos) {
+			host = addrstr.substr(0, colonIndex);
+			p = std::stoul(addrstr.substr(colonIndex + 1));
+		} //Otherwise a bare host, or an IPv6 address the numeric parser leaves to getaddrinfo (e.g. scoped)
+		if (p > 0xFFFF) {
+			throw std::runtime_error("Port out of range in " + addrstr);
+		}
+		port = (uint16_t)p;
+	}
+	std::vector<address> resolver::applyResult(const result& r, uint16_t port) {
+		if (r.error) {
+			std::rethrow_exception(r.error);
+		}
+		std::vector<address> addresses;
+		addresses.reserve(r.addresses.size());
+		for (const address& a : r.addresses) {
+			addresses.push_back(withPort(a, port));
+		}
+		return addresses;
+	}
+
+	std::vector<address> resolver::resolveAll(const std::string& addrstr, domain d) {
+		address numeric;
+		if (address::parseNumeric(addrstr, numeric, d)) {
+			return { numeric };
+		}
+		std::string host;
+		uint16_t port;
+		splitHostPort(addrstr, host, port);
+		return applyResult(*lookup(host, d), port);
+	}
+	address resolver::resolve(const std::string& addrstr, domain d) {
+		return resolveAll(addrstr, d).front();
+	}
+
+	std::future<std::vector<address>> resolver::resolveAllAsync(const std::string& addrstr, domain d) {
+		std::shared_ptr<std::promise<std::vector<address>>> promise(new std::promise<std::vector<address>>());
+		std::future<std::vector<address>> future = promise->get_future();
+		resolveAllAsync(addrstr, [promise](std::vector<address> addresses, std::exception_ptr error) -> void{
+			if (error) {
+				promise->set_exception(error);
+			} else {
+				promise->set_value(std::move(addresses));
+			}
+		}, d);
+		return future;
+	}
+	void resolver::resolveAllAsync(const std::string& addrstr, completionCallback onComplete, domain d) {
+		//Anything that does not need a lookup completes right away
+		std::string host;
+		uint16_t port;
+		std::shared_ptr<const result> r;
+		address numeric;
+		bool isNumeric;
+		try {
+			isNumeric = address::parseNumeric(addrstr, numeric, d);
+			if (!isNumeric) {
+				splitHostPort(addrstr, host, port);
+				r = cached(cacheKey(host, d));
+			}
+		} catch (...) {
+			onComplete({}, std::current_exception());
+			return;
+		}
+		if (isNumeric) {
+			onComplete({ numeric }, nullptr);
+			return;
+		}
+		if (r) {
+			std::vector<address> addresses;
+			std::exception_ptr error;
+			try {
+				addresses = applyResult(*r, port);
+			} catch (...) {
+				error = std::current_exception();
+			}
+			onComplete(std::move(addresses), error);
+			return;
+		}
+
+		//Hand the lookup to the pool
+		std::lock_guard<std::mutex> guard(m_pool->lock);
+		if (m_pool->threads.size() < m_threadCount) {
+			m_pool->threads.emplace_back(&resolver::work, m_pool);
+		}
+		m_pool->tasks.push_back([this, host, port, d, onComplete]() -> void{
+			std::vector<address> addresses;
+			std::exception_ptr error;
+			try {
+				addresses = applyResult(*lookup(host, d), port);
+			} catch (...) {
+				error = std::current_exception();
+			}
+			try {
+				onComplete(std::move(addresses), error);
+			} catch (...) {} //Nowhere to report it, and it must not end the process
+		});
+		m_pool->changed.notify_one();
+	}
+	void resolver::work(std::shared_ptr<pool> p) {
+		std::unique_lock<std::mutex> guard(p->lock);
+		while (true) {
+			p->changed.wait(guard, [&p]() -> bool{ return p->stopping || !p->tasks.empty(); });
+			if (p->tasks.empty()) {
+				return; //Stopping, and nothing left to run
+			}
+			std::function<void()> task = std::move(p->tasks.front());
+			p->tasks.pop_front();
+			guard.unlock();
+			task();
+			guard.lock();
+		}
+	}
+
+	void resolver::clear() {
+		for (std::unique_ptr<shard>& s : m_shards) {
+			std::lock_guard<std::mutex> guard(s->lock);
+			//Lookups in progress still complete for their waiters, they are just not cached
+			s->entries.clear();
+		}
+	}
+	size_t resolver::size() {
+		size_t count = 0;
+		clock::time_point now = clock::now();
+		for (std::unique_ptr<shard>& s : m_shards) {
+			std::lock_guard<std::mutex> guard(s->lock);
+			for (auto& entry : s->entries) {
+				if (!expired(entry.second, now)) {
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	std::vector<address> resolver::systemLookup(const std::string& host, domain d) {
+		addrinfo hint;
+		memset(&hint, 0, sizeof(hint));
+		hint.ai_family = d == IPv4 || d == IPv6 ? d : AF_UNSPEC;
+		hint.ai_socktype = SOCK_STREAM; //One result per address rather than one per socket type
+
+		initializationScope winsock; //getaddrinfo needs WSA on windows
+		addrinfo* results = nullptr;
+		int error = getaddrinfo(host.c_str(), NULL, &hint, &results);
+		if (error != 0) {
+			throw std::runtime_error("Could not resolve " + host + ": " + gai_strerror(error));
+		}
+		std::vector<address> addresses;
+		for (addrinfo* ai = results; ai != nullptr; ai = ai->ai_next) {
+			if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+				continue;
+			}
+			sockaddr_storage storage;
+			memcpy(&storage, ai->ai_addr, ai->ai_addrlen);
+			addresses.push_back(address(storage, ai->ai_addrlen));
+		}
+		freeaddrinfo(results);
+		return addresses;
+	}
+	resolver& resolver::shared() {
+		static resolver instance;
+		return instance;
+	}
+};
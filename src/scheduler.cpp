@@ -0,0 +1,329 @@
+#include "scheduler.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/socket.h> //connect(...) and getsockopt(...)
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h> //WinSock 2
+		#define errno WSAGetLastError()
+	#endif
+}
+#include <stdexcept>
+
+namespace sks {
+	static thread_local scheduler* currentScheduler = nullptr;
+
+	scheduler::taskHandle::taskHandle() {}
+	scheduler::taskHandle::taskHandle(scheduler* s, std::shared_ptr<taskState> state) : m_scheduler(s), m_state(std::move(state)) {}
+	void scheduler::taskHandle::cancel() {
+		if (!m_state || m_state->finished || m_state->cancelled) {
+			return;
+		}
+		m_state->cancelled = true;
+		if (m_state->pending != nullptr) {
+			m_scheduler->wake(*m_state->pending, ECANCELED);
+		} //Otherwise it is queued to run, and its next wait throws
+	}
+	bool scheduler::taskHandle::done() const {
+		return !m_state || m_state->finished;
+	}
+	std::exception_ptr scheduler::taskHandle::error() const {
+		return m_state ? m_state->error : nullptr;
+	}
+
+	scheduler::readiness::readiness(scheduler& s, int fd, int events, std::optional<clock::time_point> deadline) : m_scheduler(s) {
+		m_waiter.fd = fd;
+		m_waiter.events = events;
+		if (deadline) {
+			m_waiter.hasDeadline = true;
+			m_deadline = *deadline;
+		}
+	}
+	bool scheduler::readiness::await_ready() const noexcept {
+		return false;
+	}
+	bool scheduler::readiness::await_suspend(std::coroutine_handle<> h) {
+		m_waiter.handle = h;
+		m_waiter.owner = m_scheduler.m_running;
+		if (m_waiter.owner == nullptr) {
+			throw std::runtime_error("scheduler waits must be awaited from a task running on that scheduler");
+		}
+		if (m_waiter.owner->cancelled) {
+			m_waiter.error = ECANCELED;
+			return false; //Resume right away, await_resume throws
+		}
+		m_scheduler.suspend(m_waiter, m_deadline);
+		return true;
+	}
+	void scheduler::readiness::await_resume() {
+		if (m_waiter.error != 0) {
+			throw sysErr(m_waiter.error);
+		}
+	}
+
+	scheduler::scheduler(size_t maxEventsPerIteration) {
+		m_ready.resize(maxEventsPerIteration > 0 ? maxEventsPerIteration : 1);
+	}
+	scheduler::~scheduler() {
+		//Frames hold the waiters, so drop every reference to them first
+		for (auto& entry : m_fds) {
+			try {
+				m_pollSet.remove(entry.first);
+			} catch (...) {} //Socket already closed, throwing in a deconstructor is bad
+		}
+		m_fds.clear();
+		m_timers.clear();
+		m_runnable.clear();
+		for (auto& entry : m_tasks) {
+			entry.second->pending = nullptr;
+			entry.second->finished = true;
+			entry.second->root = task<void>();
+		}
+		m_tasks.clear();
+	}
+
+	void scheduler::suspend(waiter& w, clock::time_point deadline) {
+		if (w.fd >= 0) {
+			auto it = m_fds.find(w.fd);
+			bool registered = it != m_fds.end();
+			fdWaiters& f = registered ? it->second : m_fds[w.fd];
+			if (((w.events & readable) && f.reader != nullptr) || ((w.events & writable) && f.writer != nullptr)) {
+				if (!registered) {
+					m_fds.erase(w.fd);
+				}
+				throw sysErr(EBUSY); //Another task is already waiting for the same readiness
+			}
+			if (w.events & readable) {
+				f.reader = &w;
+			}
+			if (w.events & writable) {
+				f.writer = &w;
+			}
+			int interest = (f.reader ? readable : 0) | (f.writer ? writable : 0);
+			if (registered) {
+				m_pollSet.modify(w.fd, interest, w.fd);
+			} else {
+				m_pollSet.add(w.fd, interest, w.fd);
+			}
+		}
+		if (w.hasDeadline) {
+			w.timer = m_timers.emplace(deadline, &w);
+		}
+		w.owner->pending = &w;
+	}
+	void scheduler::wake(waiter& w, int error) {
+		if (w.fd >= 0) {
+			auto it = m_fds.find(w.fd);
+			if (it != m_fds.end()) {
+				fdWaiters& f = it->second;
+				if (f.reader == &w) {
+					f.reader = nullptr;
+				}
+				if (f.writer == &w) {
+					f.writer = nullptr;
+				}
+				int interest = (f.reader ? readable : 0) | (f.writer ? writable : 0);
+				try {
+					if (interest == 0) {
+						m_pollSet.remove(w.fd);
+					} else {
+						m_pollSet.modify(w.fd, interest, w.fd);
+					}
+				} catch (const std::system_error& e) {} //The socket was closed while waited on (e.g. by another task), nothing left to unregister
+				if (interest == 0) {
+					m_fds.erase(it);
+				}
+			}
+		}
+		if (w.hasDeadline) {
+			m_timers.erase(w.timer);
+			w.hasDeadline = false;
+		}
+		w.error = error;
+		w.owner->pending = nullptr;
+		m_runnable.push_back({ w.handle, w.owner });
+	}
+	void scheduler::resume(runnable r) {
+		taskState* previous = m_running;
+		m_running = r.owner;
+		r.handle.resume();
+		m_running = previous;
+
+		if (r.owner->root.done()) {
+			//The root task finished, along with anything it was awaiting
+			r.owner->finished = true;
+			r.owner->error = r.owner->root.m_handle.promise().error;
+			r.owner->root = task<void>(); //Frees the frame
+			m_tasks.erase(r.owner); //The state lives on if a taskHandle still refers to it
+		}
+	}
+
+	scheduler::taskHandle scheduler::spawn(task<void> t) {
+		std::shared_ptr<taskState> state(new taskState());
+		state->root = std::move(t);
+		if (state->root.done()) {
+			state->finished = true; //Empty task
+			return taskHandle(this, state);
+		}
+		m_runnable.push_back({ state->root.m_handle, state.get() });
+		m_tasks[state.get()] = state;
+		return taskHandle(this, state);
+	}
+	size_t scheduler::runOnce(std::chrono::milliseconds timeout) {
+		scheduler* previous = currentScheduler;
+		currentScheduler = this;
+		size_t resumed = 0;
+		try {
+			//Only wait if nothing is runnable already, and no longer than the next deadline
+			if (!m_runnable.empty()) {
+				timeout = std::chrono::milliseconds(0);
+			} else if (!m_timers.empty()) {
+				clock::duration untilDeadline = m_timers.begin()->first - clock::now();
+				std::chrono::milliseconds timerTimeout = std::chrono::ceil<std::chrono::milliseconds>(untilDeadline);
+				if (timerTimeout.count() < 0) {
+					timerTimeout = std::chrono::milliseconds(0);
+				}
+				if (timeout.count() < 0 || timerTimeout < timeout) {
+					timeout = timerTimeout;
+				}
+			}
+			if (!m_fds.empty() || timeout.count() != 0) {
+				size_t ready = m_pollSet.wait(m_ready.data(), m_ready.size(), timeout);
+				for (size_t i = 0; i < ready; i++) {
+					int fd = (int)m_ready[i].tag;
+					int events = m_ready[i].events;
+					auto it = m_fds.find(fd);
+					if (it != m_fds.end() && it->second.reader != nullptr && (events & (readable | hangup))) {
+						wake(*it->second.reader, 0);
+					}
+					it = m_fds.find(fd); //wake(...) may have removed the entry
+					if (it != m_fds.end() && it->second.writer != nullptr && (events & (writable | hangup))) {
+						wake(*it->second.writer, 0);
+					}
+				}
+			}
+			clock::time_point now = clock::now();
+			while (!m_timers.empty() && m_timers.begin()->first <= now) {
+				wake(*m_timers.begin()->second, ETIMEDOUT);
+			}
+
+			//Tasks queued while resuming (e.g. by cancellation) wait for the next call
+			size_t count = m_runnable.size();
+			for (size_t i = 0; i < count; i++) {
+				runnable r = m_runnable.front();
+				m_runnable.pop_front();
+				resume(r);
+				resumed++;
+			}
+		} catch (...) {
+			currentScheduler = previous;
+			throw;
+		}
+		currentScheduler = previous;
+		return resumed;
+	}
+	void scheduler::run() {
+		while (!m_tasks.empty()) {
+			runOnce();
+		}
+	}
+	size_t scheduler::size() const {
+		return m_tasks.size();
+	}
+
+	scheduler::readiness scheduler::ready(const socket& s, int events, std::optional<clock::time_point> deadline) {
+		return readiness(*this, s.socketFD(), events, deadline);
+	}
+	scheduler::readiness scheduler::sleepFor(std::chrono::milliseconds duration) {
+		return readiness(*this, -1, 0, clock::now() + duration);
+	}
+	scheduler* scheduler::current() {
+		return currentScheduler;
+	}
+
+	//socket's coroutine functions, these retry the non-blocking calls whenever the scheduler reports readiness
+	static scheduler& schedulerForAsync() {
+		scheduler* s = scheduler::current();
+		if (s == nullptr) {
+			throw std::runtime_error("socket::async* functions must be awaited from a task running on a scheduler");
+		}
+		return *s;
+	}
+	static std::optional<scheduler::clock::time_point> deadlineAfter(std::chrono::milliseconds timeout) {
+		if (timeout.count() < 0) {
+			return std::nullopt;
+		}
+		return scheduler::clock::now() + timeout;
+	}
+
+	task<size_t> socket::asyncReceive(uint8_t* buf, size_t bufSize, int flags, std::chrono::milliseconds timeout) {
+		std::optional<scheduler::clock::time_point> deadline = deadlineAfter(timeout);
+		while (true) {
+			ioResult r = tryReceive(buf, bufSize, flags);
+			if (r.status != ioWouldBlock) {
+				co_return r.bytes; //0 once closed, like receive(...)
+			}
+			co_await schedulerForAsync().ready(*this, readable, deadline);
+		}
+	}
+	task<void> socket::asyncSend(const uint8_t* data, size_t len, int flags, std::chrono::milliseconds timeout) {
+		std::optional<scheduler::clock::time_point> deadline = deadlineAfter(timeout);
+		size_t sent = 0;
+		while (sent < len) {
+			ioResult r = trySend(data + sent, len - sent, flags);
+			if (r.status == ioWouldBlock) {
+				co_await schedulerForAsync().ready(*this, writable, deadline);
+			} else {
+				sent += r.bytes;
+			}
+		}
+	}
+	task<void> socket::asyncSend(const std::vector<uint8_t>& data, int flags, std::chrono::milliseconds timeout) {
+		co_await asyncSend(data.data(), data.size(), flags, timeout);
+	}
+	task<socket> socket::asyncAccept(std::chrono::milliseconds timeout) {
+		std::optional<scheduler::clock::time_point> deadline = deadlineAfter(timeout);
+		while (true) {
+			std::unique_ptr<socket> peer = tryAccept();
+			if (peer) {
+				co_return std::move(*peer);
+			}
+			co_await schedulerForAsync().ready(*this, readable, deadline);
+		}
+	}
+	task<void> socket::asyncConnect(address to, std::chrono::milliseconds timeout) {
+		std::optional<scheduler::clock::time_point> deadline = deadlineAfter(timeout);
+		sockaddr_storage addr = to;
+		bool wasBlocking = !m_nonBlocking;
+		if (wasBlocking) {
+			nonBlocking(true);
+		}
+		int e = ::connect(m_sockFD, (sockaddr*)&addr, to.size());
+		int error = e == -1 ? errno : 0;
+		if (wasBlocking) {
+			nonBlocking(false); //The connection attempt carries on regardless
+		}
+		if (e == 0) {
+			co_return;
+		}
+		#ifdef __SKS_AS_POSIX__
+			if (error != EINPROGRESS) {
+		#elif defined __SKS_AS_WINDOWS__
+			if (error != WSAEWOULDBLOCK) {
+		#endif
+			throw sysErr(error);
+		}
+
+		//Writable once the attempt finishes, successfully or not
+		co_await schedulerForAsync().ready(*this, writable, deadline);
+		int result = 0;
+		socklen_t resultLen = sizeof(result);
+		if (getsockopt(m_sockFD, SOL_SOCKET, SO_ERROR, (char*)&result, &resultLen) == -1) {
+			throw sysErr(errno);
+		}
+		if (result != 0) {
+			throw sysErr(result);
+		}
+	}
+};
@@ -0,0 +1,356 @@
+#include "serverRuntime.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_LINUX__
+		#include <pthread.h> //pthread_setaffinity_np(...)
+		#include <sched.h> //cpu_set_t
+	#endif
+}
+#include <exception>
+
+namespace sks {
+	static const std::chrono::milliseconds acceptBackoff(100); //How long a worker stops accepting after acceptMany(...) failed
+
+	connection::connection(socket s, serverWorker& w, uint64_t id) : m_socket(std::move(s)), m_worker(w), m_id(id) {}
+
+	void connection::send(const uint8_t* data, size_t len) {
+		if (m_closed || len == 0) {
+			return;
+		}
+		if (m_queued.size() == m_queuedStart) {
+			//Nothing queued, so the data can go straight to the kernel
+			while (len > 0) {
+				ioResult r;
+				try {
+					r = m_socket.trySend(data, len);
+				} catch (const std::system_error& e) {
+					m_worker.finish(*this); //Peer is gone (EPIPE, ECONNRESET, ...)
+					return;
+				}
+				if (r.status == ioWouldBlock) {
+					break;
+				}
+				data += r.bytes;
+				len -= r.bytes;
+			}
+			if (len == 0) {
+				return;
+			}
+			try {
+				m_worker.m_loop.modify(m_socket, readable | writable); //Flushed by the worker once writable
+			} catch (const std::system_error& e) {
+				m_worker.finish(*this); //Would never be flushed
+				return;
+			}
+		}
+		m_queued.insert(m_queued.end(), data, data + len);
+	}
+	void connection::send(const std::vector<uint8_t>& data) {
+		send(data.data(), data.size());
+	}
+	void connection::close() {
+		if (m_closed) {
+			return;
+		}
+		m_closing = true;
+		if (queued() == 0) {
+			m_worker.finish(*this);
+		}
+	}
+	size_t connection::queued() const {
+		return m_queued.size() - m_queuedStart;
+	}
+
+	socket& connection::sock() {
+		return m_socket;
+	}
+	address connection::peer() const {
+		return m_socket.connectedAddress();
+	}
+	uint64_t connection::id() const {
+		return m_id;
+	}
+	serverWorker& connection::worker() {
+		return m_worker;
+	}
+
+	serverWorker::serverWorker(serverRuntime& runtime, size_t index, socket& listener, const serverHandlers& handlers, size_t receiveBufferSize) : m_runtime(runtime), m_index(index), m_listener(listener), m_handlers(handlers), m_wake(createUnixPair(stream)) {
+		m_receiveBuffer.resize(receiveBufferSize > 0 ? receiveBufferSize : 1);
+		m_listener.nonBlocking(true); //acceptMany(...) then has nothing to switch per call
+		m_wake.first.nonBlocking(true);
+		m_wake.second.nonBlocking(true);
+		m_loop.add(m_listener, readable, [this](socket&, int) {
+			accept();
+		});
+		m_loop.add(m_wake.second, readable, [this](socket&, int) {
+			runInbox();
+		});
+	}
+
+	void serverWorker::accept() {
+		std::vector<socket> accepted;
+		try {
+			accepted = m_listener.acceptMany();
+		} catch (const std::system_error& e) {
+			//E.g. out of file descriptors (EMFILE/ENFILE); the listener stays readable, so stop watching it for a while rather than spin
+			try {
+				m_loop.modify(m_listener, 0);
+				m_acceptPaused = true;
+				m_acceptResume = std::chrono::steady_clock::now() + acceptBackoff;
+			} catch (const std::system_error& modifyError) {}
+			return;
+		}
+		for (socket& s : accepted) {
+			uint64_t id = m_nextSequence++ * m_runtime.size() + m_index; //Unique without sharing a counter between workers
+			std::unique_ptr<connection> owned(new connection(std::move(s), *this, id));
+			connection* c = owned.get();
+			try {
+				m_loop.add(c->m_socket, readable, [this, c](socket&, int events) {
+					if (events & (readable | hangup)) {
+						receive(*c);
+					}
+					if ((events & writable) && !c->m_closed) {
+						flush(*c);
+					}
+				});
+			} catch (const std::system_error& e) {
+				continue; //Could not be watched, so it is closed right away
+			}
+			m_connections[id] = std::move(owned);
+			if (m_handlers.onOpen) {
+				try {
+					m_handlers.onOpen(*c);
+				} catch (const std::exception& e) {
+					finish(*c); //Handler errors only end their own connection
+				}
+			}
+		}
+	}
+	void serverWorker::receive(connection& c) {
+		//Take what is there, without letting one busy connection starve the rest
+		for (size_t i = 0; i < 4 && !c.m_closed; i++) {
+			ioResult r;
+			try {
+				r = c.m_socket.tryReceive(m_receiveBuffer.data(), m_receiveBuffer.size());
+			} catch (const std::system_error& e) {
+				finish(c); //Reset or otherwise failed
+				return;
+			}
+			if (r.status == ioWouldBlock) {
+				return;
+			}
+			if (r.status == ioClosed) {
+				finish(c);
+				return;
+			}
+			if (m_handlers.onData) {
+				try {
+					m_handlers.onData(c, m_receiveBuffer.data(), r.bytes);
+				} catch (const std::exception& e) {
+					finish(c);
+					return;
+				}
+			}
+			if (r.bytes < m_receiveBuffer.size()) {
+				return; //Drained
+			}
+		}
+	}
+	void serverWorker::flush(connection& c) {
+		while (c.queued() > 0) {
+			ioResult r;
+			try {
+				r = c.m_socket.trySend(c.m_queued.data() + c.m_queuedStart, c.queued());
+			} catch (const std::system_error& e) {
+				finish(c);
+				return;
+			}
+			if (r.status == ioWouldBlock) {
+				return;
+			}
+			c.m_queuedStart += r.bytes;
+		}
+		c.m_queued.clear();
+		c.m_queuedStart = 0;
+		try {
+			m_loop.modify(c.m_socket, readable);
+		} catch (const std::system_error& e) {
+			finish(c);
+			return;
+		}
+		if (c.m_closing) {
+			finish(c);
+		}
+	}
+	void serverWorker::finish(connection& c) {
+		if (c.m_closed) {
+			return;
+		}
+		c.m_closed = true;
+		try {
+			m_loop.remove(c.m_socket);
+		} catch (const std::system_error& e) {} //Closing the socket unregisters it regardless
+		if (m_handlers.onClose) {
+			try {
+				m_handlers.onClose(c);
+			} catch (const std::exception& e) {} //Closing regardless
+		}
+		//c may still be in use further up the stack (e.g. close() from its own onData), so it is only freed after dispatch
+		auto it = m_connections.find(c.m_id);
+		m_retired.push_back(std::move(it->second));
+		m_connections.erase(it);
+	}
+	void serverWorker::runInbox() {
+		//Drain the wake-up bytes first, so a post(...) racing with the swap below always leaves one behind
+		uint8_t discard[64];
+		while (m_wake.second.tryReceive(discard, sizeof(discard)).status == ioDone) {}
+		{
+			std::lock_guard<std::mutex> guard(m_inboxLock);
+			m_running.swap(m_inbox);
+		}
+		for (task& t : m_running) {
+			if (t) {
+				try {
+					t(*this);
+				} catch (const std::exception& e) {} //One failed task does not stop the others, nor the worker
+			}
+		}
+		m_running.clear();
+	}
+	void serverWorker::post(task t) {
+		bool wasEmpty;
+		{
+			std::lock_guard<std::mutex> guard(m_inboxLock);
+			wasEmpty = m_inbox.empty();
+			m_inbox.push_back(std::move(t));
+		}
+		if (wasEmpty) {
+			uint8_t wake = 0;
+			m_wake.first.trySend(&wake, 1); //A full pipe already means a wake-up is pending
+		}
+	}
+	void serverWorker::run(const std::atomic<bool>& stopping) {
+		while (!stopping) {
+			std::chrono::milliseconds timeout(-1);
+			if (m_acceptPaused) {
+				std::chrono::steady_clock::duration left = m_acceptResume - std::chrono::steady_clock::now();
+				if (left.count() <= 0) {
+					try {
+						m_loop.modify(m_listener, readable);
+						m_acceptPaused = false;
+					} catch (const std::system_error& e) {
+						m_acceptResume = std::chrono::steady_clock::now() + acceptBackoff;
+					}
+				} else {
+					timeout = std::chrono::duration_cast<std::chrono::milliseconds>(left) + std::chrono::milliseconds(1); //Round up
+				}
+			}
+			m_loop.runOnce(timeout);
+			m_retired.clear();
+		}
+		//Close whatever is still open
+		while (!m_connections.empty()) {
+			finish(*m_connections.begin()->second);
+		}
+		m_retired.clear(); //The listener stays registered, in case the runtime is started again
+	}
+
+	size_t serverWorker::index() const {
+		return m_index;
+	}
+	serverRuntime& serverWorker::runtime() {
+		return m_runtime;
+	}
+	size_t serverWorker::size() const {
+		return m_connections.size();
+	}
+	connection* serverWorker::find(uint64_t id) {
+		auto it = m_connections.find(id);
+		return it != m_connections.end() ? it->second.get() : nullptr;
+	}
+	void serverWorker::forEach(const std::function<void(connection& c)>& f) {
+		//f may close connections, which removes them from the table, so walk a snapshot
+		std::vector<connection*> open;
+		open.reserve(m_connections.size());
+		for (auto& entry : m_connections) {
+			open.push_back(entry.second.get());
+		}
+		for (connection* c : open) {
+			if (!c->m_closed) {
+				f(*c);
+			}
+		}
+	}
+
+	static bool steerWhenPinned(bool pinned) {
+		#ifdef __SKS_AS_LINUX__
+			return pinned;
+		#else
+			return false; //Steering is Linux only
+		#endif
+	}
+
+	serverRuntime::serverRuntime(const address& at, serverHandlers handlers, size_t workers, bool pinned, size_t receiveBufferSize) : m_listeners(at, stream, workers, steerWhenPinned(pinned)), m_handlers(std::move(handlers)), m_stopping(false), m_pinned(pinned) {
+		for (size_t i = 0; i < m_listeners.size(); i++) {
+			m_workers.emplace_back(new serverWorker(*this, i, m_listeners[i], m_handlers, receiveBufferSize));
+		}
+	}
+	serverRuntime::~serverRuntime() {
+		stop();
+		wait();
+	}
+
+	void serverRuntime::start() {
+		if (!m_threads.empty()) {
+			return; //Already running
+		}
+		m_stopping = false;
+		size_t cpus = std::thread::hardware_concurrency();
+		for (size_t i = 0; i < m_workers.size(); i++) {
+			serverWorker* w = m_workers[i].get();
+			m_threads.emplace_back([this, w]() {
+				w->run(m_stopping);
+			});
+			#ifdef __SKS_AS_LINUX__
+				if (m_pinned && cpus > 0) {
+					cpu_set_t set;
+					CPU_ZERO(&set);
+					CPU_SET(i % cpus, &set);
+					pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(set), &set); //Best effort, e.g. the CPU may be outside this process' allowed set
+				}
+			#else
+				(void)cpus; //Pinning is Linux only
+			#endif
+		}
+	}
+	void serverRuntime::run() {
+		start();
+		wait();
+	}
+	void serverRuntime::stop() {
+		m_stopping = true;
+		for (std::unique_ptr<serverWorker>& w : m_workers) {
+			w->post(nullptr); //Wake it, so it notices
+		}
+	}
+	void serverRuntime::wait() {
+		for (std::thread& t : m_threads) {
+			t.join();
+		}
+		m_threads.clear();
+	}
+
+	void serverRuntime::post(size_t worker, serverWorker::task t) {
+		if (worker >= m_workers.size()) {
+			throw sysErr(EINVAL);
+		}
+		m_workers[worker]->post(std::move(t));
+	}
+	size_t serverRuntime::size() const {
+		return m_workers.size();
+	}
+	const address& serverRuntime::localAddress() const {
+		return m_listeners.localAddress();
+	}
+};
@@ -1,15 +1,25 @@
 #include "socks.hpp"
 #include "errors.hpp"
+#include "ioRing.hpp"
 #include "initialization.hpp"
 #include "macros.hpp"
 extern "C" {
 	#ifdef __SKS_AS_POSIX__
 		#include <sys/socket.h> //general socket
+		#include <sys/un.h> //sockaddr_un
 		#include <unistd.h> //close(...) and unlink(...)
 		#include <poll.h> //poll(...)
 		#include <unistd.h> //unlink(...)
 		#include <sys/time.h> //timeval
 		#include <sys/ioctl.h>
+		#include <sys/uio.h> //iovec
+		#include <limits.h> //IOV_MAX
+		#include <fcntl.h> //open(...) and fcntl(...)
+		#include <sys/stat.h> //fstat(...)
+		#ifdef __SKS_AS_LINUX__
+			#include <netinet/udp.h> //UDP_SEGMENT and UDP_GRO
+			#include <sys/sendfile.h> //sendfile(...)
+		#endif
 	#elif defined __SKS_AS_WINDOWS__
 		#include <ws2tcpip.h> //WinSock 2
 		//#include <io.h> //_mktemp
@@ -29,6 +39,8 @@ extern "C" {
 #include <vector>
 #include <chrono>
 #include <csignal>
+#include <cstring>
+#include <cstddef> //offsetof
 
 namespace sks {
 	const versionInfo version = { 0, 10, 0 };
@@ -94,37 +106,63 @@ namespace sks {
 		std::swap(m_domain, s.m_domain);
 		std::swap(m_type, s.m_type);
 		std::swap(m_protocol, s.m_protocol);
+		std::swap(m_nonBlocking, s.m_nonBlocking);
+		std::swap(m_unlinkOnClose, s.m_unlinkOnClose);
+		std::swap(m_closeMode, s.m_closeMode);
+		std::swap(m_kernelSegmentation, s.m_kernelSegmentation);
+		std::swap(m_drainTimeout, s.m_drainTimeout);
+		std::swap(m_peer, s.m_peer);
+		std::swap(m_ring, s.m_ring);
+		if (m_ring) {
+			m_ring->moved(*this);
+		}
 	}
 
 	socket::~socket() {
+		if (m_ring) {
+			m_ring->forget(*this); //Otherwise the ring keeps the file open, and maps whatever reuses the fd number to it
+		}
 		//If we have just done a move operation on this socket, file descriptor should not be touched/read
 		if (m_validFD) {
-			//(Potentially) used later, but cannot be got after shutdown and closing
-			#ifdef __SKS_AS_POSIX__
-				address local = localAddress();
-			#endif
-			//Shutdown socket
-			//This makes sure all remaining bytes are sent to network before closing it up
-			//Long story short, no data is lost unless it is lost while traversing the network
-			//Also may send protocol info, such as a FIN for TCP
+			//(Potentially) used later, but cannot be got after closing
+			//Only named unix sockets need it, so nothing else pays for the lookup
 			#ifdef __SKS_AS_POSIX__
-				shutdown(m_sockFD, SHUT_RDWR);
-			#else
-				shutdown(m_sockFD, SD_BOTH);
+				std::string unlinkPath;
+				if (m_unlinkOnClose) {
+					try {
+						unlinkPath = ((unixAddress)localAddress()).name();
+					} catch (...) {} //Throwing in a deconstructor is bad
+				}
 			#endif
-			//On error, -1 shall be returned and errno set to indicate the error.
-			//For the reasons below, no checking is done on shutdown(...)
-			/*-----------------------------------------------------------------------------------------\
-			|  EBADF   | The socket argument is not a valid file descriptor.                           | EBADF isn't checked since we personally handle the fd
-			|  EINVAL  | The how argument is invalid.                                                  | EINVAL is a set value and will not happen in normal operation
-			| ENOTCONN | The socket is not connected.                                                  | ENOTCONN may occur here under normal operation, ignore if it does
-			| ENOTSOCK | The socket argument does not refer to a socket.                               | ENOTSOCK isn't checked since we personally handle the fd
-			| ENOBUFS  | Insufficient resources were available in the system to perform the operation. |
-			\-----------------------------------------------------------------------------------------*/
-			
+
+			switch (m_closeMode) {
+				case closeFast:
+					break; //close(...) alone still sends queued data and a FIN
+				case closeShutdown:
+					//Shutdown socket
+					//This makes sure all remaining bytes are sent to network before closing it up, even if the descriptor was duplicated
+					//On error, -1 shall be returned and errno set to indicate the error.
+					//No checking is done, ENOTCONN may occur here under normal operation
+					#ifdef __SKS_AS_POSIX__
+						shutdown(m_sockFD, SHUT_RDWR);
+					#else
+						shutdown(m_sockFD, SD_BOTH);
+					#endif
+					break;
+				case closeAbortive: {
+					//A zero linger timeout makes close(...) discard queued data and send a RST
+					linger l;
+					l.l_onoff = 1;
+					l.l_linger = 0;
+					setsockopt(m_sockFD, SOL_SOCKET, SO_LINGER, (const char*)&l, sizeof(l));
+					break;
+				}
+				case closeDrain:
+					drain();
+					break;
+			}
+
 			//Close socket fully
-			//Any bytes not transmitted are gone
-			//I'm not certain, but I think this isn't a formal/clean close either
 			#ifdef __SKS_AS_POSIX__
 				int e = close(m_sockFD);
 			#else
@@ -144,12 +182,9 @@ namespace sks {
 			}
 			
 			#ifdef __SKS_AS_POSIX__
-				if (m_domain == unix) {
-					unixAddress localUnix = (unixAddress)local;
-					if (localUnix.named()) {
-						//We are currently bound to a named unix address, unlink it
-						unlink(localUnix.name().c_str());
-					}
+				if (!unlinkPath.empty()) {
+					//We were bound to a named unix address, unlink it
+					unlink(unlinkPath.c_str());
 				}
 			#endif
 
@@ -159,12 +194,66 @@ namespace sks {
 		}
 	}
 
+	void socket::drain() {
+		//Only connections have anything to drain
+		if (m_type != stream && m_type != seq) {
+			return;
+		}
+		#ifdef __SKS_AS_POSIX__
+			if (shutdown(m_sockFD, SHUT_WR) == -1) {
+		#else
+			if (shutdown(m_sockFD, SD_SEND) == -1) {
+		#endif
+			return; //Not connected (ENOTCONN), nothing to wait for
+		}
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + m_drainTimeout;
+		uint8_t discard[0x1000];
+		while (true) {
+			std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+			if (left.count() <= 0) {
+				return;
+			}
+			std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(left) + std::chrono::milliseconds(1); //Round up
+			pollfd pfd = { (decltype(pollfd::fd))m_sockFD, POLLIN, 0 };
+			int e = poll(&pfd, 1, (int)remaining.count());
+			if (e == -1) {
+				#ifdef __SKS_AS_POSIX__
+					if (errno == EINTR) {
+						continue;
+					}
+				#endif
+				return;
+			}
+			if (e == 0) {
+				return; //Timed out
+			}
+			//Readable, so this does not wait even if the socket is blocking
+			ssize_t r = recv(m_sockFD, (char*)discard, sizeof(discard), 0);
+			if (r <= 0) {
+				return; //Peer finished (or reset) the connection
+			}
+		}
+	}
+
 	socket& socket::operator=(socket&& s) {
 		std::swap(m_validFD, s.m_validFD);
 		std::swap(m_sockFD, s.m_sockFD);
 		std::swap(m_domain, s.m_domain);
 		std::swap(m_type, s.m_type);
 		std::swap(m_protocol, s.m_protocol);
+		std::swap(m_nonBlocking, s.m_nonBlocking);
+		std::swap(m_unlinkOnClose, s.m_unlinkOnClose);
+		std::swap(m_closeMode, s.m_closeMode);
+		std::swap(m_kernelSegmentation, s.m_kernelSegmentation);
+		std::swap(m_drainTimeout, s.m_drainTimeout);
+		std::swap(m_peer, s.m_peer);
+		std::swap(m_ring, s.m_ring);
+		if (m_ring) {
+			m_ring->moved(*this);
+		}
+		if (s.m_ring) {
+			s.m_ring->moved(s);
+		}
 		return *this;
 	}
 
@@ -215,6 +304,13 @@ namespace sks {
 			*/
 			throw sysErr(errno);
 		}
+		#ifdef __SKS_AS_POSIX__
+			//Named (pathname) unix addresses leave a file behind, remembered so only these sockets look it up on destruction
+			if (m_domain == unix) {
+				const sockaddr_un* un = (const sockaddr_un*)address;
+				m_unlinkOnClose = (size_t)len > offsetof(sockaddr_un, sun_path) + 1 && un->sun_path[0] != '\0';
+			}
+		#endif
 	}
 	
 	void socket::listen(int backlog) {
@@ -233,13 +329,19 @@ namespace sks {
 	}
 	
 	socket socket::accept() {
-		int peerFD = ::accept(m_sockFD, nullptr, nullptr);
+		sockaddr_storage peerAddr;
+		socklen_t peerLen = sizeof(peerAddr);
+		int peerFD = ::accept(m_sockFD, (sockaddr*)&peerAddr, &peerLen);
 		//On error, -1 is returned, and errno is set appropriately.
 		if (peerFD == -1) {
 			throw sysErr(errno);
 		}
 		//We have the file descriptor, construct a socket (class) around it
 		socket peer(peerFD, m_domain, m_type, m_protocol);
+		peer.m_peer.assign(peerAddr, peerLen); //Already known, so connectedAddress() needs no getpeername(...)
+		#ifdef __SKS_AS_WINDOWS__
+			peer.m_nonBlocking = m_nonBlocking; //Accepted sockets inherit the listener's mode on windows (but not on linux)
+		#endif
 		return peer;
 	}
 	
@@ -333,7 +435,718 @@ namespace sks {
 		}
 		return r;
 	}
+	pooledBuffer socket::receive(bufferPool& pool, size_t bufSize, int flags) {
+		pooledBuffer buffer = pool.acquire(bufSize);
+		buffer.resize(receive(buffer.data(), buffer.size(), flags));
+		return buffer;
+	}
+	pooledBuffer socket::receive(address& from, bufferPool& pool, size_t bufSize, int flags) {
+		pooledBuffer buffer = pool.acquire(bufSize);
+		buffer.resize(receive(from, buffer.data(), buffer.size(), flags));
+		return buffer;
+	}
 	
+	#ifdef __SKS_AS_POSIX__
+		typedef iovec ioVector;
+		static const size_t maxIOVectors = IOV_MAX;
+		static ioVector toIOVector(const uint8_t* data, size_t size) {
+			iovec v;
+			v.iov_base = (void*)data;
+			v.iov_len = size;
+			return v;
+		}
+		static uint8_t*& ioVectorData(ioVector& v) {
+			return (uint8_t*&)v.iov_base;
+		}
+		static size_t& ioVectorSize(ioVector& v) {
+			return v.iov_len;
+		}
+	#else
+		typedef WSABUF ioVector;
+		static const size_t maxIOVectors = 1024;
+		static ioVector toIOVector(const uint8_t* data, size_t size) {
+			WSABUF v;
+			v.buf = (char*)data;
+			v.len = size;
+			return v;
+		}
+		static uint8_t*& ioVectorData(ioVector& v) {
+			return (uint8_t*&)v.buf;
+		}
+		static ULONG& ioVectorSize(ioVector& v) {
+			return v.len;
+		}
+	#endif
+
+	//Scatter/gather calls take an array of system buffer descriptors, small counts are converted on the stack
+	static const size_t localIOVectors = 16;
+
+	static size_t sendVectors(int sockFD, ioVector* vectors, size_t count, const sockaddr* toAddr, socklen_t addrLen, int flags) {
+		#ifdef __SKS_AS_POSIX__
+			msghdr msg = {};
+			msg.msg_name = (void*)toAddr;
+			msg.msg_namelen = addrLen;
+			msg.msg_iov = vectors;
+			msg.msg_iovlen = count;
+			ssize_t r = sendmsg(sockFD, &msg, flags | MSG_NOSIGNAL);
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			return r;
+		#else
+			DWORD sent = 0;
+			if (WSASendTo(sockFD, vectors, count, &sent, flags, toAddr, addrLen, nullptr, nullptr) == SOCKET_ERROR) {
+				throw sysErr(errno);
+			}
+			return sent;
+		#endif
+	}
+	static void sendAll(int sockFD, const constBuffer* buffers, size_t count, const sockaddr* toAddr, socklen_t addrLen, int flags) {
+		ioVector local[localIOVectors];
+		std::vector<ioVector> extended;
+		ioVector* vectors = local;
+		if (count > localIOVectors) {
+			extended.resize(count);
+			vectors = extended.data();
+		}
+		size_t remaining = 0;
+		size_t used = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (buffers[i].size != 0) { //Empty buffers are left out, some protocols reject them
+				vectors[used++] = toIOVector(buffers[i].data, buffers[i].size);
+				remaining += buffers[i].size;
+			}
+		}
+		count = used;
+
+		//A send may stop part-way through any buffer, so skip what was sent and go again
+		size_t first = 0;
+		while (remaining > 0) {
+			size_t batch = count - first < maxIOVectors ? count - first : maxIOVectors;
+			size_t sent = sendVectors(sockFD, vectors + first, batch, toAddr, addrLen, flags);
+			remaining -= sent;
+			while (sent > 0) {
+				size_t step = sent < ioVectorSize(vectors[first]) ? sent : ioVectorSize(vectors[first]);
+				ioVectorData(vectors[first]) += step;
+				ioVectorSize(vectors[first]) -= step;
+				sent -= step;
+				if (ioVectorSize(vectors[first]) == 0) {
+					first++;
+				}
+			}
+		}
+	}
+	static size_t receiveVectors(int sockFD, const mutableBuffer* buffers, size_t count, sockaddr* fromAddr, socklen_t* addrLen, int flags) {
+		ioVector local[localIOVectors];
+		std::vector<ioVector> extended;
+		ioVector* vectors = local;
+		if (count > maxIOVectors) {
+			count = maxIOVectors; //Cannot fill more than this in one call anyway
+		}
+		if (count > localIOVectors) {
+			extended.resize(count);
+			vectors = extended.data();
+		}
+		for (size_t i = 0; i < count; i++) {
+			vectors[i] = toIOVector(buffers[i].data, buffers[i].size);
+		}
+		#ifdef __SKS_AS_POSIX__
+			msghdr msg = {};
+			msg.msg_name = fromAddr;
+			msg.msg_namelen = addrLen ? *addrLen : 0;
+			msg.msg_iov = vectors;
+			msg.msg_iovlen = count;
+			ssize_t r = recvmsg(sockFD, &msg, flags | MSG_NOSIGNAL);
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			if (addrLen) {
+				*addrLen = msg.msg_namelen;
+			}
+			return r;
+		#else
+			DWORD received = 0;
+			DWORD msgFlags = flags;
+			int fromLen = addrLen ? *addrLen : 0;
+			if (WSARecvFrom(sockFD, vectors, count, &received, &msgFlags, fromAddr, addrLen ? &fromLen : nullptr, nullptr, nullptr) == SOCKET_ERROR) {
+				throw sysErr(errno);
+			}
+			if (addrLen) {
+				*addrLen = fromLen;
+			}
+			return received;
+		#endif
+	}
+
+	//Headers for one batched call are kept on the stack, larger batches take several calls
+	static const size_t batchSize = 64;
+
+	size_t socket::receiveMany(const mutableBuffer* buffers, size_t* lengths, sockaddr_storage* peers, socklen_t* peerLengths, size_t count, std::chrono::milliseconds timeout, int flags) {
+		if (count == 0) {
+			return 0;
+		}
+		if (timeout.count() >= 0) {
+			pollfd pfd;
+			pfd.fd = m_sockFD;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			int r = poll(&pfd, 1, timeout.count());
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			if (pfd.revents == 0) {
+				return 0; //Timed out; errors/hangups fall through so the receive reports them
+			}
+		}
+
+		size_t received = 0;
+		#ifdef __SKS_AS_LINUX__
+			mmsghdr msgs[batchSize];
+			iovec vectors[batchSize];
+			while (received < count) {
+				size_t batch = count - received < batchSize ? count - received : batchSize;
+				for (size_t i = 0; i < batch; i++) {
+					vectors[i].iov_base = buffers[received + i].data;
+					vectors[i].iov_len = buffers[received + i].size;
+					msghdr& msg = msgs[i].msg_hdr;
+					msg = {};
+					msg.msg_iov = &vectors[i];
+					msg.msg_iovlen = 1;
+					if (peers) {
+						msg.msg_name = &peers[received + i];
+						msg.msg_namelen = sizeof(sockaddr_storage);
+					}
+				}
+				//Only the very first datagram is waited for
+				int batchFlags = flags | (received == 0 ? MSG_WAITFORONE : MSG_DONTWAIT);
+				if (m_type == dgram) {
+					batchFlags |= MSG_TRUNC; //Report full datagram sizes; on stream sockets this would discard the data instead
+				}
+				int r = recvmmsg(m_sockFD, msgs, batch, batchFlags, nullptr);
+				if (r == -1) {
+					if (received > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+						break;
+					}
+					throw sysErr(errno);
+				}
+				for (int i = 0; i < r; i++) {
+					lengths[received + i] = msgs[i].msg_len;
+					if (peerLengths) {
+						peerLengths[received + i] = peers ? msgs[i].msg_hdr.msg_namelen : 0;
+					}
+				}
+				received += r;
+				if ((size_t)r < batch) {
+					break; //Queue drained
+				}
+			}
+		#else
+			for (; received < count; received++) {
+				if (received > 0 && !readReady()) {
+					break; //Only the very first datagram is waited for
+				}
+				sockaddr_storage* from = peers ? &peers[received] : nullptr;
+				socklen_t fromLen = sizeof(sockaddr_storage);
+				ssize_t r = recvfrom(m_sockFD, (char*)buffers[received].data, buffers[received].size, flags | MSG_NOSIGNAL, (sockaddr*)from, from ? &fromLen : nullptr);
+				if (r == -1) {
+					throw sysErr(errno);
+				}
+				lengths[received] = r;
+				if (peerLengths) {
+					peerLengths[received] = from ? fromLen : 0;
+				}
+			}
+		#endif
+		return received;
+	}
+	void socket::sendMany(const constBuffer* buffers, const sockaddr_storage* peers, const socklen_t* peerLengths, size_t count, int flags) {
+		size_t sent = 0;
+		#ifdef __SKS_AS_LINUX__
+			mmsghdr msgs[batchSize];
+			iovec vectors[batchSize];
+			while (sent < count) {
+				size_t batch = count - sent < batchSize ? count - sent : batchSize;
+				for (size_t i = 0; i < batch; i++) {
+					vectors[i].iov_base = (void*)buffers[sent + i].data;
+					vectors[i].iov_len = buffers[sent + i].size;
+					msghdr& msg = msgs[i].msg_hdr;
+					msg = {};
+					msg.msg_iov = &vectors[i];
+					msg.msg_iovlen = 1;
+					if (peers) {
+						msg.msg_name = (void*)&peers[sent + i];
+						msg.msg_namelen = peerLengths ? peerLengths[sent + i] : sizeof(sockaddr_storage);
+					}
+				}
+				//sendmmsg may stop early (e.g. full send buffer), so keep going from where it stopped
+				int r = sendmmsg(m_sockFD, msgs, batch, flags | MSG_NOSIGNAL);
+				if (r == -1) {
+					throw sysErr(errno);
+				}
+				sent += r;
+			}
+		#else
+			for (; sent < count; sent++) {
+				const sockaddr* to = peers ? (const sockaddr*)&peers[sent] : nullptr;
+				socklen_t toLen = peers ? (peerLengths ? peerLengths[sent] : sizeof(sockaddr_storage)) : 0;
+				if (::sendto(m_sockFD, (const char*)buffers[sent].data, buffers[sent].size, flags | MSG_NOSIGNAL, to, toLen) == -1) {
+					throw sysErr(errno);
+				}
+			}
+		#endif
+	}
+
+	static void sendSegments(int sockFD, bool& kernelSegmentation, const uint8_t* data, size_t len, uint16_t segmentSize, const sockaddr* toAddr, socklen_t addrLen, int flags) {
+		if (segmentSize == 0) {
+			throw sysErr(EINVAL);
+		}
+		size_t sent = 0;
+		#ifdef UDP_SEGMENT
+			if (kernelSegmentation) {
+				//Each call may carry at most 64 segments (UDP_MAX_SEGMENTS) and must fit in one IP packet before segmentation
+				const size_t maxSegments = 64;
+				const size_t maxPayload = 0xFFFF - 8 - 20; //UDP and IPv4 headers; IPv6 allows a little more, so this fits either
+				size_t perCall = (maxPayload / segmentSize) * segmentSize;
+				if (perCall > segmentSize * maxSegments) {
+					perCall = segmentSize * maxSegments;
+				}
+				if (perCall == 0) {
+					perCall = segmentSize; //Too large for one packet anyway, let the kernel report it
+				}
+
+				do {
+					size_t chunk = len - sent < perCall ? len - sent : perCall;
+					iovec vector;
+					vector.iov_base = (void*)(data + sent);
+					vector.iov_len = chunk;
+					msghdr msg = {};
+					msg.msg_name = (void*)toAddr;
+					msg.msg_namelen = addrLen;
+					msg.msg_iov = &vector;
+					msg.msg_iovlen = 1;
+					alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))];
+					if (chunk > segmentSize) {
+						msg.msg_control = control;
+						msg.msg_controllen = sizeof(control);
+						cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+						cm->cmsg_level = SOL_UDP;
+						cm->cmsg_type = UDP_SEGMENT;
+						cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+						memcpy(CMSG_DATA(cm), &segmentSize, sizeof(uint16_t));
+					}
+					if (sendmsg(sockFD, &msg, flags | MSG_NOSIGNAL) == -1) {
+						int e = errno;
+						//The kernel or device can't segment (e.g. no checksum offload, or segments larger than the MTU), split the rest in user space from now on
+						if (msg.msg_control && (e == EINVAL || e == ENOPROTOOPT || e == EOPNOTSUPP || e == EIO)) {
+							kernelSegmentation = false;
+							break;
+						}
+						throw sysErr(e);
+					}
+					sent += chunk;
+				} while (sent < len);
+				if (kernelSegmentation) {
+					return;
+				}
+			}
+		#endif
+		//Split in user space, one datagram per segment
+		do {
+			size_t chunk = len - sent < segmentSize ? len - sent : segmentSize;
+			if (::sendto(sockFD, (const char*)data + sent, chunk, flags | MSG_NOSIGNAL, toAddr, addrLen) == -1) {
+				throw sysErr(errno);
+			}
+			sent += chunk;
+		} while (sent < len);
+	}
+	static size_t receiveSegments(int sockFD, uint8_t* buf, size_t bufSize, uint16_t& segmentSize, sockaddr* fromAddr, socklen_t* addrLen, int flags) {
+		#ifdef UDP_GRO
+			iovec vector;
+			vector.iov_base = buf;
+			vector.iov_len = bufSize;
+			msghdr msg = {};
+			msg.msg_name = fromAddr;
+			msg.msg_namelen = addrLen ? *addrLen : 0;
+			msg.msg_iov = &vector;
+			msg.msg_iovlen = 1;
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			ssize_t r = recvmsg(sockFD, &msg, flags | MSG_NOSIGNAL);
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			if (addrLen) {
+				*addrLen = msg.msg_namelen;
+			}
+			segmentSize = r; //Not coalesced unless told otherwise
+			for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+				if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+					int size;
+					memcpy(&size, CMSG_DATA(cm), sizeof(int));
+					segmentSize = size;
+				}
+			}
+			return r;
+		#else
+			ssize_t r = recvfrom(sockFD, (char*)buf, bufSize, flags | MSG_NOSIGNAL, fromAddr, addrLen);
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			segmentSize = r; //Never coalesced
+			return r;
+		#endif
+	}
+
+	void socket::sendSegmented(const uint8_t* data, size_t len, uint16_t segmentSize, int flags) {
+		if (m_type != dgram || (m_domain != IPv4 && m_domain != IPv6)) {
+			m_kernelSegmentation = false;
+		}
+		sendSegments(m_sockFD, m_kernelSegmentation, data, len, segmentSize, nullptr, 0, flags);
+	}
+	void socket::sendSegmented(const uint8_t* data, size_t len, uint16_t segmentSize, const address& to, int flags) {
+		if (m_type != dgram || (m_domain != IPv4 && m_domain != IPv6)) {
+			m_kernelSegmentation = false;
+		}
+		sockaddr_storage addr = to;
+		sendSegments(m_sockFD, m_kernelSegmentation, data, len, segmentSize, (sockaddr*)&addr, to.size(), flags);
+	}
+	size_t socket::receiveCoalesced(uint8_t* buf, size_t bufSize, uint16_t& segmentSize, int flags) {
+		return receiveSegments(m_sockFD, buf, bufSize, segmentSize, nullptr, nullptr, flags);
+	}
+	size_t socket::receiveCoalesced(address& from, uint8_t* buf, size_t bufSize, uint16_t& segmentSize, int flags) {
+		sockaddr_storage addr;
+		socklen_t addrLen = sizeof(addr);
+		size_t recvSize = receiveSegments(m_sockFD, buf, bufSize, segmentSize, (sockaddr*)&addr, &addrLen, flags);
+		from = address(addr, addrLen);
+		return recvSize;
+	}
+
+	#ifdef __SKS_AS_POSIX__
+		//One transfer from a file to a socket through a buffer, returns the number of bytes sent (0 at end of file)
+		static size_t copyFile(int sockFD, int fileFD, uint64_t offset, size_t length, int flags) {
+			uint8_t buffer[0x10000];
+			ssize_t r = pread(fileFD, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			if (r == 0) {
+				return 0; //End of file
+			}
+			r = ::send(sockFD, buffer, r, flags | MSG_NOSIGNAL); //Whatever is not sent is read again next time
+			if (r == -1) {
+				throw sysErr(errno);
+			}
+			return r;
+		}
+		//One transfer from a file to a socket, returns the number of bytes sent (0 at end of file)
+		static size_t transferFile(int sockFD, int fileFD, uint64_t offset, size_t length) {
+			#ifdef __SKS_AS_LINUX__
+				off_t off = offset;
+				ssize_t r = sendfile(sockFD, fileFD, &off, length);
+				if (r == -1) {
+					throw sysErr(errno);
+				}
+				return r;
+			#else
+				return copyFile(sockFD, fileFD, offset, length, 0); //No portable sendfile
+			#endif
+		}
+	#endif
+
+	void socket::sendFile(int fileFD, uint64_t offset, size_t length) {
+		#ifdef __SKS_AS_POSIX__
+			size_t sent = 0;
+			//sendfile may not send all data at once, so we have a loop here
+			while (sent < length) {
+				size_t r = transferFile(m_sockFD, fileFD, offset + sent, length - sent);
+				if (r == 0) {
+					throw sysErr(ENODATA); //File ended before length bytes were sent
+				}
+				sent += r;
+			}
+		#else
+			throw std::runtime_error("sendFile is not implemented for windows systems.");
+		#endif
+	}
+	void socket::sendFile(const std::string& path, uint64_t offset, size_t length) {
+		#ifdef __SKS_AS_POSIX__
+			int fileFD = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fileFD == -1) {
+				throw sysErr(errno);
+			}
+			try {
+				struct stat info;
+				if (fstat(fileFD, &info) == -1) {
+					throw sysErr(errno);
+				}
+				uint64_t size = info.st_size;
+				if (offset > size) {
+					throw sysErr(EINVAL);
+				}
+				if (length > size - offset) {
+					length = size - offset;
+				}
+				sendFile(fileFD, offset, length);
+			} catch (...) {
+				close(fileFD);
+				throw;
+			}
+			close(fileFD);
+		#else
+			throw std::runtime_error("sendFile is not implemented for windows systems.");
+		#endif
+	}
+	size_t socket::trySendFile(int fileFD, uint64_t& offset, size_t length) {
+		#ifdef __SKS_AS_POSIX__
+			if (length == 0) {
+				return 0;
+			}
+			//sendfile has no per-call flag to avoid blocking, and switching the socket's (shared) mode would race with other users of it
+			//So it is only used once the socket is non-blocking anyway; otherwise the data goes through a buffer and send(...) with MSG_DONTWAIT
+			size_t sent;
+			try {
+				if (m_nonBlocking) {
+					sent = transferFile(m_sockFD, fileFD, offset, length);
+				} else {
+					sent = copyFile(m_sockFD, fileFD, offset, length, MSG_DONTWAIT);
+				}
+			} catch (const std::system_error& e) {
+				if (e.code() == std::errc::operation_would_block || e.code() == std::errc::resource_unavailable_try_again) {
+					return 0;
+				}
+				throw;
+			}
+			if (sent == 0) {
+				throw sysErr(ENODATA); //File ended before length bytes were sent, like sendFile(...)
+			}
+			offset += sent;
+			return sent;
+		#else
+			throw std::runtime_error("trySendFile is not implemented for windows systems.");
+		#endif
+	}
+
+	#ifdef __SKS_AS_POSIX__
+		static bool wouldBlock(int e) {
+			return e == EAGAIN || e == EWOULDBLOCK;
+		}
+	#elif defined __SKS_AS_WINDOWS__
+		static bool wouldBlock(int e) {
+			return e == WSAEWOULDBLOCK;
+		}
+	#endif
+	static void setNonBlocking(int sockFD, bool enable) {
+		#ifdef __SKS_AS_POSIX__
+			int fileFlags = fcntl(sockFD, F_GETFL);
+			if (fileFlags == -1) {
+				throw sysErr(errno);
+			}
+			fileFlags = enable ? fileFlags | O_NONBLOCK : fileFlags & ~O_NONBLOCK;
+			if (fcntl(sockFD, F_SETFL, fileFlags) == -1) {
+				throw sysErr(errno);
+			}
+		#elif defined __SKS_AS_WINDOWS__
+			u_long mode = enable ? 1 : 0;
+			if (ioctlsocket(sockFD, FIONBIO, &mode) != 0) {
+				throw sysErr(errno);
+			}
+		#endif
+	}
+	//Keeps a single call from blocking
+	//POSIX has MSG_DONTWAIT for that, windows does not, so there the socket is switched to non-blocking mode for the call's duration
+	class nonBlockingCall {
+	protected:
+		int m_sockFD;
+		bool m_restore = false;
+	public:
+		nonBlockingCall(int sockFD, bool alreadyNonBlocking) : m_sockFD(sockFD) {
+			#ifdef __SKS_AS_WINDOWS__
+				if (!alreadyNonBlocking) {
+					setNonBlocking(sockFD, true);
+					m_restore = true;
+				}
+			#else
+				(void)alreadyNonBlocking; //MSG_DONTWAIT does it per call
+			#endif
+		}
+		~nonBlockingCall() {
+			if (m_restore) {
+				try {
+					setNonBlocking(m_sockFD, false);
+				} catch (...) {} //Nothing sensible to do in a deconstructor
+			}
+		}
+		int flags() const {
+			#ifdef __SKS_AS_POSIX__
+				return MSG_DONTWAIT;
+			#else
+				return 0;
+			#endif
+		}
+	};
+
+	ioResult socket::trySend(const uint8_t* data, size_t len, int flags) {
+		return trySend(data, len, nullptr, 0, flags);
+	}
+	ioResult socket::trySend(const uint8_t* data, size_t len, const address& to, int flags) {
+		sockaddr_storage addr = to;
+		return trySend(data, len, (const sockaddr*)&addr, to.size(), flags);
+	}
+	ioResult socket::trySend(const uint8_t* data, size_t len, const sockaddr* toAddr, socklen_t addrLen, int flags) {
+		nonBlockingCall call(m_sockFD, m_nonBlocking);
+		ssize_t r = ::sendto(m_sockFD, (const char*)data, len, flags | call.flags() | MSG_NOSIGNAL, toAddr, addrLen);
+		if (r == -1) {
+			int e = errno;
+			if (wouldBlock(e)) {
+				return { ioWouldBlock, 0 };
+			}
+			throw sysErr(e);
+		}
+		return { ioDone, (size_t)r };
+	}
+	ioResult socket::tryReceive(uint8_t* buf, size_t bufSize, int flags) {
+		return tryReceive(nullptr, nullptr, buf, bufSize, flags);
+	}
+	ioResult socket::tryReceive(address& from, uint8_t* buf, size_t bufSize, int flags) {
+		sockaddr_storage addr;
+		socklen_t addrLen = sizeof(addr);
+		ioResult result = tryReceive((sockaddr*)&addr, &addrLen, buf, bufSize, flags);
+		if (result.status == ioDone) {
+			from = address(addr, addrLen);
+		}
+		return result;
+	}
+	ioResult socket::tryReceive(sockaddr* fromAddr, socklen_t* addrLen, uint8_t* buf, size_t bufSize, int flags) {
+		nonBlockingCall call(m_sockFD, m_nonBlocking);
+		ssize_t r = recvfrom(m_sockFD, (char*)buf, bufSize, flags | call.flags() | MSG_NOSIGNAL, fromAddr, addrLen);
+		if (r == -1) {
+			int e = errno;
+			if (wouldBlock(e)) {
+				return { ioWouldBlock, 0 };
+			}
+			throw sysErr(e);
+		}
+		if (r == 0 && bufSize > 0 && m_type != dgram) {
+			return { ioClosed, 0 }; //Only datagrams can be empty
+		}
+		return { ioDone, (size_t)r };
+	}
+	std::unique_ptr<socket> socket::tryAccept() {
+		//accept has no per-call flag, and switching the listener's (shared) mode would race with other threads accepting on it
+		//So a blocking listener is polled first; it can still wait if another thread takes the connection in between
+		if (!m_nonBlocking && !readReady(std::chrono::milliseconds(0))) {
+			return nullptr;
+		}
+		sockaddr_storage peerAddr;
+		socklen_t peerLen = sizeof(peerAddr);
+		int peerFD = ::accept(m_sockFD, (sockaddr*)&peerAddr, &peerLen);
+		if (peerFD == -1) {
+			int e = errno;
+			if (wouldBlock(e)) {
+				return nullptr;
+			}
+			throw sysErr(e);
+		}
+		std::unique_ptr<socket> peer(new socket(peerFD, m_domain, m_type, m_protocol));
+		peer->m_peer.assign(peerAddr, peerLen);
+		#ifdef __SKS_AS_WINDOWS__
+			peer->m_nonBlocking = m_nonBlocking; //Inherited from the listener on windows
+		#endif
+		return peer;
+	}
+
+	std::vector<socket> socket::acceptMany(size_t maxCount, bool nonBlockingPeers) {
+		std::vector<socket> peers;
+		#ifdef __SKS_AS_LINUX__
+			//accept4 sets up each peer in the same call; like tryAccept(), a blocking listener is polled before each one rather than switched
+			int flags = SOCK_CLOEXEC | (nonBlockingPeers ? SOCK_NONBLOCK : 0);
+			int e = 0;
+			while (peers.size() < maxCount) {
+				if (!m_nonBlocking && !readReady(std::chrono::milliseconds(0))) {
+					break;
+				}
+				sockaddr_storage peerAddr;
+				socklen_t peerLen = sizeof(peerAddr);
+				int peerFD = accept4(m_sockFD, (sockaddr*)&peerAddr, &peerLen, flags);
+				if (peerFD == -1) {
+					e = errno;
+					if (e == EINTR || e == ECONNABORTED) {
+						e = 0;
+						continue; //Interrupted, or the connection was dropped before we got to it
+					}
+					break;
+				}
+				peers.push_back(socket(peerFD, m_domain, m_type, m_protocol));
+				peers.back().m_peer.assign(peerAddr, peerLen);
+				peers.back().m_nonBlocking = nonBlockingPeers;
+			}
+			if (e != 0 && !wouldBlock(e) && peers.empty()) {
+				throw sysErr(e); //Errors after the first connection are left for the next call
+			}
+		#else
+			while (peers.size() < maxCount) {
+				std::unique_ptr<socket> peer = tryAccept();
+				if (!peer) {
+					break;
+				}
+				if (nonBlockingPeers) {
+					peer->nonBlocking(true);
+				}
+				peers.push_back(std::move(*peer));
+			}
+		#endif
+		return peers;
+	}
+
+	void socket::shutdownWrite() {
+		#ifdef __SKS_AS_POSIX__
+			int e = shutdown(m_sockFD, SHUT_WR);
+		#else
+			int e = shutdown(m_sockFD, SD_SEND);
+		#endif
+		if (e == -1) {
+			throw sysErr(errno);
+		}
+	}
+	void socket::closePolicy(closeMode mode, std::chrono::milliseconds drainTimeout) {
+		m_closeMode = mode;
+		m_drainTimeout = drainTimeout;
+	}
+	closeMode socket::closePolicy() const {
+		return m_closeMode;
+	}
+
+	void socket::send(const std::vector<constBuffer>& buffers, int flags) {
+		return send(buffers.data(), buffers.size(), flags);
+	}
+	void socket::send(const constBuffer* buffers, size_t count, int flags) {
+		sendAll(m_sockFD, buffers, count, nullptr, 0, flags);
+	}
+	void socket::send(const std::vector<constBuffer>& buffers, const address& to, int flags) {
+		return send(buffers.data(), buffers.size(), to, flags);
+	}
+	void socket::send(const constBuffer* buffers, size_t count, const address& to, int flags) {
+		sockaddr_storage addr = to;
+		sendAll(m_sockFD, buffers, count, (sockaddr*)&addr, to.size(), flags);
+	}
+	size_t socket::receive(const std::vector<mutableBuffer>& buffers, int flags) {
+		return receive(buffers.data(), buffers.size(), flags);
+	}
+	size_t socket::receive(const mutableBuffer* buffers, size_t count, int flags) {
+		return receiveVectors(m_sockFD, buffers, count, nullptr, nullptr, flags);
+	}
+	size_t socket::receive(address& from, const std::vector<mutableBuffer>& buffers, int flags) {
+		return receive(from, buffers.data(), buffers.size(), flags);
+	}
+	size_t socket::receive(address& from, const mutableBuffer* buffers, size_t count, int flags) {
+		sockaddr_storage addr;
+		socklen_t addrLen = sizeof(addr);
+		size_t recvSize = receiveVectors(m_sockFD, buffers, count, (sockaddr*)&addr, &addrLen, flags);
+		from = address(addr, addrLen);
+		return recvSize;
+	}
+
 	#ifdef __SKS_AS_POSIX__
 		typedef timeval timeoutT;
 		timeval microsecondsToTimeoutT(std::chrono::microseconds us) {
@@ -392,6 +1205,40 @@ namespace sks {
 
 		return timeoutTToMicroseconds(tv);
 	}
+	void socket::receiveCoalescing(bool enable) {
+		#ifdef UDP_GRO
+			int value = enable;
+			int e = setsockopt(m_sockFD, SOL_UDP, UDP_GRO, &value, sizeof(value));
+			if (e == -1) {
+				throw sysErr(errno);
+			}
+		#else
+			if (enable) {
+				throw sysErr(ENOPROTOOPT); //Datagrams are always received one at a time
+			}
+		#endif
+	}
+	bool socket::receiveCoalescing() const {
+		#ifdef UDP_GRO
+			int value = 0;
+			socklen_t valueLen = sizeof(value);
+			int e = getsockopt(m_sockFD, SOL_UDP, UDP_GRO, &value, &valueLen);
+			if (e == -1) {
+				throw sysErr(errno);
+			}
+			return value != 0;
+		#else
+			return false;
+		#endif
+	}
+
+	void socket::nonBlocking(bool enable) {
+		setNonBlocking(m_sockFD, enable);
+		m_nonBlocking = enable;
+	}
+	bool socket::nonBlocking() const {
+		return m_nonBlocking;
+	}
 
 	bool socket::writeReady(std::chrono::milliseconds timeout) const {
 		//Check if the socket can be written to, waiting for up to <timeout> milliseconds
@@ -478,12 +1325,22 @@ namespace sks {
 	}
 	
 	address socket::connectedAddress() const {
+		if (m_peer.size() > 0) {
+			return m_peer;
+		}
 		sockaddr_storage sa;
 		socklen_t salen = sizeof(sa);
 		connectedAddress((sockaddr*)&sa, &salen);
 		return address(sa, salen);
 	}
 	void socket::connectedAddress(sockaddr* addr, socklen_t* len) const {
+		if (m_peer.size() > 0) {
+			//Truncated like getpeername(...), with len set to the full size
+			sockaddr_storage sa = m_peer;
+			memcpy(addr, &sa, *len < m_peer.size() ? *len : m_peer.size());
+			*len = m_peer.size();
+			return;
+		}
 		int e = getpeername(m_sockFD, addr, len);
 		if (e == -1) {
 			throw sysErr(errno);
@@ -505,6 +1362,9 @@ namespace sks {
 	int socket::socketFD(bool takeOwnership) {
 		if (takeOwnership) {
 			m_validFD = false; //We have lost ownership. Do not do anything with socket when deconstructing
+			if (m_ring) {
+				m_ring->forget(*this); //The registration belongs to this socket, not to the fd's new owner
+			}
 		}
 		return m_sockFD;
 	}
@@ -558,6 +1418,7 @@ namespace sks {
 
 	std::vector<std::reference_wrapper<socket>> writeReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout) {
 		std::vector<pollfd> pollstructs;
+		pollstructs.reserve(sockets.size());
 		for (size_t i = 0; i < sockets.size(); i++) {
 			pollfd pfd;
 			pfd.fd = sockets[i].get().m_sockFD;
@@ -583,6 +1444,7 @@ namespace sks {
 	}
 	std::vector<std::reference_wrapper<socket>> readReadySockets(std::vector<std::reference_wrapper<socket>>& sockets, std::chrono::milliseconds timeout) {
 		std::vector<pollfd> pollstructs;
+		pollstructs.reserve(sockets.size());
 		for (size_t i = 0; i < sockets.size(); i++) {
 			pollfd pfd;
 			pfd.fd = sockets[i].get().m_sockFD;
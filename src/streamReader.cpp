@@ -0,0 +1,133 @@
+#include "streamReader.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_LINUX__
+		#include <sys/mman.h> //memfd_create(...) and mmap(...)
+		#include <unistd.h> //ftruncate(...) and sysconf(...)
+	#endif
+}
+
+namespace sks {
+	static size_t roundToPowerOfTwo(size_t n) {
+		size_t p = 1;
+		while (p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	streamReader::streamReader(socket& s, size_t capacity, bool mirror) : m_socket(s) {
+		m_capacity = roundToPowerOfTwo(capacity > 0 ? capacity : 1);
+		#ifdef __SKS_AS_LINUX__
+			if (mirror) {
+				size_t page = sysconf(_SC_PAGESIZE);
+				size_t size = m_capacity > page ? m_capacity : page;
+				int fd = memfd_create("sks::streamReader", 0);
+				if (fd != -1) {
+					//Reserve twice the size, then map the same memory into both halves
+					void* base = MAP_FAILED;
+					if (ftruncate(fd, size) == 0) {
+						base = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					}
+					if (base != MAP_FAILED) {
+						void* first = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+						void* second = mmap((uint8_t*)base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+						if (first != MAP_FAILED && second != MAP_FAILED) {
+							m_memory = (uint8_t*)base;
+							m_capacity = size;
+							m_mirrored = true;
+						} else {
+							munmap(base, size * 2);
+						}
+					}
+					close(fd); //The mappings keep the memory alive
+				}
+			}
+		#endif
+		if (!m_mirrored) {
+			m_memory = new uint8_t[m_capacity];
+		}
+	}
+	streamReader::~streamReader() {
+		if (m_mirrored) {
+			#ifdef __SKS_AS_LINUX__
+				munmap(m_memory, m_capacity * 2);
+			#endif
+		} else {
+			delete[] m_memory;
+		}
+	}
+
+	size_t streamReader::fill(int flags) {
+		size_t free = space();
+		if (free == 0) {
+			return 0;
+		}
+		size_t start = m_tail & (m_capacity - 1);
+		mutableBuffer segments[2] = { { m_memory + start, free }, { m_memory, 0 } };
+		size_t count = 1;
+		if (!m_mirrored && start + free > m_capacity) {
+			segments[0].size = m_capacity - start;
+			segments[1].size = free - segments[0].size;
+			count = 2;
+		}
+		size_t r = m_socket.receive(segments, count, flags);
+		if (r == 0) {
+			m_ended = true;
+		}
+		m_tail += r;
+		return r;
+	}
+	bool streamReader::fillUntil(size_t n, int flags) {
+		if (n > m_capacity) {
+			throw sysErr(EINVAL); //Could never be satisfied
+		}
+		while (available() < n) {
+			if (fill(flags) == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constBuffer streamReader::peek() const {
+		constBuffer segments[2];
+		peek(segments);
+		return segments[0];
+	}
+	size_t streamReader::peek(constBuffer segments[2]) const {
+		size_t unread = available();
+		size_t start = m_head & (m_capacity - 1);
+		segments[0] = { m_memory + start, unread };
+		segments[1] = { m_memory, 0 };
+		if (!m_mirrored && start + unread > m_capacity) {
+			segments[0].size = m_capacity - start;
+			segments[1].size = unread - segments[0].size;
+			return 2;
+		}
+		return unread > 0 ? 1 : 0;
+	}
+	void streamReader::consume(size_t n) {
+		if (n > available()) {
+			throw sysErr(EINVAL);
+		}
+		m_head += n;
+	}
+
+	size_t streamReader::available() const {
+		return m_tail - m_head;
+	}
+	size_t streamReader::space() const {
+		return m_capacity - available();
+	}
+	size_t streamReader::capacity() const {
+		return m_capacity;
+	}
+	bool streamReader::mirrored() const {
+		return m_mirrored;
+	}
+	bool streamReader::ended() const {
+		return m_ended;
+	}
+};
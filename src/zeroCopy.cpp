@@ -0,0 +1,154 @@
+#include "zeroCopy.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+extern "C" {
+	#ifdef __SKS_AS_POSIX__
+		#include <sys/socket.h> //send(...), recvmsg(...)
+		#include <poll.h> //poll(...)
+		#ifdef __SKS_AS_LINUX__
+			#include <netinet/in.h> //IP_RECVERR and IPV6_RECVERR
+			#include <linux/errqueue.h> //sock_extended_err
+		#endif
+	#elif defined __SKS_AS_WINDOWS__
+		#include <ws2tcpip.h> //WinSock 2
+
+		#define MSG_NOSIGNAL 0 //Windows does not have this flag, and instead has SO_NOSIGPIPE
+		#define poll WSAPoll
+		#define ssize_t int
+		#define errno WSAGetLastError() //Acceptable, but only if reading socket errors, per https://docs.microsoft.com/en-us/windows/win32/winsock/error-codes-errno-h-errno-and-wsagetlasterror-2
+	#endif
+}
+#include <vector>
+
+namespace sks {
+	//Notification IDs wrap around, so compare them by distance
+	static bool idBefore(uint32_t a, uint32_t b) {
+		return (int32_t)(a - b) < 0;
+	}
+
+	zeroCopySender::zeroCopySender(socket& s, releaseCallback onRelease) : m_socket(s), m_release(std::move(onRelease)) {
+		#if defined SO_ZEROCOPY && defined MSG_ZEROCOPY
+			int value = 1;
+			//Fails for sockets (or kernels) without zero-copy support, in which case every send is a copy
+			m_zeroCopy = setsockopt(m_socket.socketFD(), SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == 0;
+			m_notifying = m_zeroCopy;
+		#endif
+	}
+
+	uint32_t zeroCopySender::send(const uint8_t* data, size_t len, int flags) {
+		pendingSend p = { m_nextToken++, m_nextID, m_nextID, 0, false };
+		int fd = m_socket.socketFD();
+		size_t sent = 0;
+		//send may not send all data at once, so we have a loop here (see socket::send(...))
+		while (sent < len) {
+			ssize_t r = -1;
+			#ifdef MSG_ZEROCOPY
+				if (m_zeroCopy) {
+					r = ::send(fd, (const char*)data + sent, len - sent, flags | MSG_NOSIGNAL | MSG_ZEROCOPY);
+					if (r != -1) {
+						m_nextID++; //Every successful zero-copy call is assigned the next ID
+						p.remaining++;
+					} else if (errno != ENOBUFS) {
+						throw sysErr(errno);
+					}
+					//ENOBUFS: Too many notifications outstanding, copy this part instead
+				}
+			#endif
+			if (r == -1) {
+				r = ::send(fd, (const char*)data + sent, len - sent, flags | MSG_NOSIGNAL);
+				if (r == -1) {
+					throw sysErr(errno);
+				}
+			}
+			sent += r;
+		}
+		p.lastID = m_nextID - 1;
+		p.copied = p.remaining == 0; //Released on the next drainCompletions(...)
+		m_pending.push_back(p);
+		return p.token;
+	}
+
+	void zeroCopySender::complete(uint32_t firstID, uint32_t lastID, bool copied) {
+		for (pendingSend& p : m_pending) {
+			if (p.remaining == 0 || idBefore(lastID, p.firstID) || idBefore(p.lastID, firstID)) {
+				continue; //Already done, or no overlap
+			}
+			uint32_t from = idBefore(firstID, p.firstID) ? p.firstID : firstID;
+			uint32_t to = idBefore(p.lastID, lastID) ? p.lastID : lastID;
+			p.remaining -= to - from + 1;
+			p.copied |= copied;
+		}
+		if (copied) {
+			m_zeroCopy = false; //Zero-copy costs more than a copy when the kernel copies anyway
+		}
+	}
+	size_t zeroCopySender::releaseFinished() {
+		//Collected first so callbacks can safely send again
+		std::vector<pendingSend> finished;
+		for (auto it = m_pending.begin(); it != m_pending.end();) {
+			if (it->remaining == 0) {
+				finished.push_back(*it);
+				it = m_pending.erase(it);
+			} else {
+				it++;
+			}
+		}
+		for (const pendingSend& p : finished) {
+			m_release(p.token, p.copied);
+		}
+		return finished.size();
+	}
+
+	size_t zeroCopySender::drainCompletions(std::chrono::milliseconds timeout) {
+		int fd = m_socket.socketFD();
+		bool waited = false;
+		while (true) {
+			#ifdef SO_EE_ORIGIN_ZEROCOPY
+				//Notifications are queued on the socket's error queue (only read if zero-copy was ever enabled, other sockets may treat MSG_ERRQUEUE as a normal receive)
+				while (m_notifying) {
+					alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage))];
+					msghdr msg = {};
+					msg.msg_control = control;
+					msg.msg_controllen = sizeof(control);
+					if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+						if (errno == EAGAIN || errno == EWOULDBLOCK) {
+							break;
+						}
+						throw sysErr(errno);
+					}
+					for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+						bool isError = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+						if (!isError) {
+							continue;
+						}
+						const sock_extended_err* e = (const sock_extended_err*)CMSG_DATA(cm);
+						if (e->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+							//IDs ee_info through ee_data (inclusive) are complete
+							complete(e->ee_info, e->ee_data, (e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+						}
+					}
+				}
+			#endif
+			size_t released = releaseFinished();
+			if (released > 0 || waited || timeout.count() == 0 || m_pending.empty() || !m_notifying) {
+				return released;
+			}
+
+			//Error queue readiness is reported as POLLERR
+			pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = 0;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, timeout.count() < 0 ? -1 : (int)timeout.count()) == -1) {
+				throw sysErr(errno);
+			}
+			waited = true;
+		}
+	}
+	size_t zeroCopySender::pending() const {
+		return m_pending.size();
+	}
+	bool zeroCopySender::usingZeroCopy() const {
+		return m_zeroCopy;
+	}
+};
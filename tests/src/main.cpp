@@ -48,6 +48,32 @@ int main(int argc, char** argv) {
 	btf::addTestPermutations("Closed socket connections can be detected (%0, %1)", {"8"},          closedSocketCanBeDetected);
 	btf::addTestPermutations("Addresses comparisons are correct (%0)",             {"9"},          addressComparisonsAreCorrect);
 	btf::allTests.push_back({"Default-constructed address has size of zero",       {"10"},         defaultConstructedAddressHasSizeOfZero});
+	btf::addTestPermutations("eventLoop dispatches ready sockets (%0, %1)",        {"11"},         eventLoopDispatchesReadySockets);
+	btf::addTestPermutations("pollSet reports tagged events (%0, %1)",             {"12"},         pollSetReportsTaggedEvents);
+	btf::allTests.push_back({"ioRing transfers data",                              {"13"},         ioRingTransfersData});
+	btf::addTestPermutations("Vectored send and receive (%0, %1)",                 {"14"},         vectoredSendAndReceive);
+	btf::addTestPermutations("Datagrams can be batched (%0)",                      {"15"},         datagramsCanBeBatched);
+	btf::addTestPermutations("Datagrams can be segmented (%0)",                    {"16"},         datagramsCanBeSegmented);
+	btf::addTestPermutations("Zero-copy sends are released (%0)",                  {"17"},         zeroCopySendsAreReleased);
+	btf::addTestPermutations("Files can be sent (%0)",                             {"18"},         filesCanBeSent);
+	btf::addTestPermutations("relay forwards both directions (%0)",                {"19"},         relayForwardsBothDirections);
+	btf::addTestPermutations("Addresses format without allocating (%0)",          {"20"},         addressesFormatWithoutAllocating);
+	btf::allTests.push_back({"Numeric literals parse without resolving",          {"21"},         numericLiteralsParseWithoutResolving});
+	btf::allTests.push_back({"resolver caches and coalesces lookups",             {"22"},         resolverCachesAndCoalescesLookups});
+	btf::allTests.push_back({"resolver resolves asynchronously",                   {"23"},         resolverResolvesAsynchronously});
+	btf::addTestPermutations("Pooled receives reuse buffers (%0, %1)",            {"24"},         pooledReceivesReuseBuffers);
+	btf::addTestPermutations("streamReader parses in place (%0)",                 {"25"},         streamReaderParsesInPlace);
+	btf::addTestPermutations("Non-blocking transfers report would-block (%0, %1)", {"26"},         nonBlockingTransfersReportWouldBlock);
+	btf::allTests.push_back({"Addresses construct concurrently",                  {"28"},         addressesConstructConcurrently});
+	btf::addTestPermutations("Close policies end connections (%0)",               {"29"},         closePoliciesEndConnections);
+	btf::addTestPermutations("acceptMany drains the backlog (%0)",                {"30"},         acceptManyDrainsTheBacklog);
+	btf::addTestPermutations("listenerGroup spreads connections (%0, %1)",        {"31"},         listenerGroupSpreadsConnections);
+	btf::addTestPermutations("serverRuntime serves connections (%0)",             {"32"},         serverRuntimeServesConnections);
+	btf::addTestPermutations("connectionPool reuses connections (%0)",            {"33"},         connectionPoolReusesConnections);
+	btf::addTestPermutations("framedSocket transfers messages (%0)",              {"34"},         framedSocketsTransferMessages);
+	#ifdef __SKS_HAS_COROUTINES__
+	btf::addTestPermutations("Coroutines serve connections (%0)",                  {"27"},         coroutinesServeConnections);
+	#endif
 
 	//Print info before run starts
 	btf::preRun = [](std::vector<btf::test> testsToRun, size_t threadCount) -> void{
@@ -1,11 +1,31 @@
 #include <ostream>
 #include "socks.hpp"
+#include "pollSet.hpp"
+#include "eventLoop.hpp"
+#include "ioRing.hpp"
+#include "zeroCopy.hpp"
+#include "relay.hpp"
+#include "resolver.hpp"
+#include "streamReader.hpp"
+#include "listenerGroup.hpp"
+#include "serverRuntime.hpp"
+#include "connectionPool.hpp"
+#include "framedSocket.hpp"
+#ifdef __SKS_HAS_COROUTINES__
+#include "scheduler.hpp"
+#endif
 #include "steps.hpp"
 #include "utility.hpp"
 #include <mutex>
 #include <memory>
 #include <thread>
+#include <atomic>
+#include <future>
+#include <condition_variable>
 #include <btf/testing.hpp>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
 
 static const std::chrono::milliseconds timeoutGrace(5); //Allow 1ms extra for timeouts (Code isn't instant, and the OS will get to our call when it gets to it)
 static const std::chrono::milliseconds timeoutError(5); //Allowed +/- to timeouts (Add above for upper-bound)
@@ -257,3 +277,1353 @@ void addressComparisonsAreCorrect(std::ostream& log, const sks::domain& d) {
 void defaultConstructedAddressHasSizeOfZero(std::ostream& log) {
 	assertEqual(sks::address().size(), 0, "Default-constructed address has non-zero size");
 }
+
+void eventLoopDispatchesReadySockets(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	assertSystemSupports(log, d, t);
+
+	auto sockets = getRelatedSockets(log, d, t);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	sks::eventLoop loop;
+	size_t callbackCount = 0;
+	int callbackEvents = 0;
+	loop.add(sockA, sks::readable, [&](sks::socket& s, int events) -> void{
+		assertTrue(s == sockA, "Callback was given the wrong socket");
+		callbackCount++;
+		callbackEvents = events;
+	});
+
+	//Nothing sent yet, nothing should be dispatched
+	log << "Running loop without any data to read" << std::endl;
+	assertEqual(loop.runOnce(std::chrono::milliseconds(0)), 0, "Loop dispatched a socket which was not ready");
+
+	log << "Sending data to socket" << std::endl;
+	if (t == sks::stream || t == sks::seq) {
+		sockB.send({'C', 'h', 'e', 'c', 'k'});
+	} else {
+		sockB.send({'C', 'h', 'e', 'c', 'k'}, sockA.localAddress());
+	}
+
+	log << "Running loop with data to read" << std::endl;
+	assertEqual(loop.runOnce(std::chrono::milliseconds(100)), 1, "Loop did not dispatch the ready socket");
+	assertEqual(callbackCount, 1, "Callback was not called exactly once");
+	assertTrue((callbackEvents & sks::readable) == sks::readable, "Callback was not told the socket is readable");
+
+	loop.remove(sockA);
+	assertEqual(loop.size(), 0, "Loop still has a registration after removal");
+	assertEqual(loop.runOnce(std::chrono::milliseconds(0)), 0, "Loop dispatched a removed socket");
+}
+
+void pollSetReportsTaggedEvents(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	assertSystemSupports(log, d, t);
+
+	auto sockets = getRelatedSockets(log, d, t);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	sks::pollSet set;
+	sks::pollSet::event results[4];
+	set.add(sockA, sks::readable | sks::writable, 0xA);
+	set.add(sockB, sks::readable, 0xB);
+	assertEqual(set.size(), 2, "pollSet size does not match registrations");
+
+	//Nothing sent yet, only sockA's write interest should be ready
+	log << "Waiting without any data to read" << std::endl;
+	size_t n = set.wait(results, 4, std::chrono::milliseconds(0));
+	assertEqual(n, 1, "pollSet reported an unexpected number of ready sockets");
+	assertEqual(results[0].tag, 0xA, "pollSet reported the wrong tag");
+	assertEqual(results[0].events, sks::writable, "pollSet reported the wrong events");
+
+	//Only read interest from here on
+	set.modify(sockA, sks::readable, 0xC);
+	log << "Sending data to socket" << std::endl;
+	if (t == sks::stream || t == sks::seq) {
+		sockB.send({'C', 'h', 'e', 'c', 'k'});
+	} else {
+		sockB.send({'C', 'h', 'e', 'c', 'k'}, sockA.localAddress());
+	}
+	n = set.wait(results, 4, std::chrono::milliseconds(100));
+	assertEqual(n, 1, "pollSet reported an unexpected number of ready sockets");
+	assertEqual(results[0].tag, 0xC, "pollSet reported the old tag after modify");
+	assertEqual(results[0].events, sks::readable, "pollSet reported the wrong events");
+
+	set.remove(sockA);
+	n = set.wait(results, 4, std::chrono::milliseconds(0));
+	assertEqual(n, 0, "pollSet reported a removed socket");
+	assertEqual(set.size(), 1, "pollSet size was not updated on removal");
+
+	//Removing again must not count it twice
+	int error = 0;
+	try {
+		set.remove(sockA);
+	} catch (const std::system_error& e) {
+		error = e.code().value();
+	}
+	assertEqual(error, ENOENT, "pollSet removed a socket that was not registered");
+	assertEqual(set.size(), 1, "pollSet size changed after a failed removal");
+}
+
+void ioRingTransfersData(std::ostream& log) {
+	//Run once with io_uring (if available) and once with the fallback
+	for (bool allowIoUring : { true, false }) {
+		sks::ioRing ring(32, 4, allowIoUring);
+		log << "Using " << (ring.usingIoUring() ? "io_uring" : "fallback") << std::endl;
+
+		auto sockets = getRelatedSockets(log, sks::IPv4, sks::stream);
+		sks::socket& sockA = sockets.first;
+		sks::socket& sockB = sockets.second;
+		ring.registerSocket(sockB);
+
+		std::string message = "Submitted through a ring";
+		std::vector<uint8_t> received(message.size());
+		ring.receive(sockB, received.data(), received.size(), 1, MSG_WAITALL);
+		ring.send(sockA, (const uint8_t*)message.data(), message.size(), 2);
+		assertEqual(ring.submit(), 2, "Not every prepared operation was submitted");
+
+		size_t completed = 0;
+		sks::ioCompletion completions[4];
+		while (completed < 2) {
+			size_t n = ring.reap(completions, 4, std::chrono::milliseconds(100));
+			assertGreaterThan(n, 0, "Timed out waiting for completions");
+			for (size_t i = 0; i < n; i++) {
+				assertEqual(completions[i].result, (int)message.size(), "Operation transferred the wrong number of bytes");
+				completed++;
+			}
+		}
+		assertEqual(std::string(received.begin(), received.end()), message, "Received message differs from sent message");
+	}
+}
+
+void vectoredSendAndReceive(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	assertSystemSupports(log, d, t);
+
+	auto sockets = getRelatedSockets(log, d, t);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	std::string header = "HEAD";
+	std::string payload = "Payload sent without joining it to the header";
+	std::vector<sks::constBuffer> out = {
+		{ (const uint8_t*)header.data(), header.size() },
+		{ nullptr, 0 }, //Empty buffers are skipped
+		{ (const uint8_t*)payload.data(), payload.size() },
+	};
+
+	log << "Sending vectored message" << std::endl;
+	if (t == sks::stream || t == sks::seq) {
+		sockA.send(out);
+	} else {
+		sockA.send(out, sockB.localAddress());
+	}
+
+	std::vector<uint8_t> headerIn(header.size());
+	std::vector<uint8_t> payloadIn(payload.size());
+	std::vector<sks::mutableBuffer> in = {
+		{ headerIn.data(), headerIn.size() },
+		{ payloadIn.data(), payloadIn.size() },
+	};
+	size_t received = 0;
+	if (t == sks::stream) {
+		//Stream sockets may split the data across receives
+		while (received < header.size() + payload.size()) {
+			std::vector<sks::mutableBuffer> rest;
+			size_t skip = received;
+			for (const sks::mutableBuffer& b : in) {
+				if (skip >= b.size) {
+					skip -= b.size;
+					continue;
+				}
+				rest.push_back({ b.data + skip, b.size - skip });
+				skip = 0;
+			}
+			received += sockB.receive(rest);
+		}
+	} else if (t == sks::seq) {
+		received = sockB.receive(in);
+	} else {
+		sks::address from;
+		received = sockB.receive(from, in);
+		assertEqual(from, sockA.localAddress(), "Socket received data from wrong address");
+	}
+	log << "Received vectored message" << std::endl;
+
+	assertEqual(received, header.size() + payload.size(), "Received the wrong number of bytes");
+	assertEqual(std::string(headerIn.begin(), headerIn.end()), header, "Received header differs from sent header");
+	assertEqual(std::string(payloadIn.begin(), payloadIn.end()), payload, "Received payload differs from sent payload");
+}
+
+void datagramsCanBeBatched(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::dgram);
+
+	auto sockets = getRelatedSockets(log, d, sks::dgram);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	const size_t count = 100; //More than one batch
+	std::vector<std::string> messages;
+	std::vector<sks::constBuffer> out;
+	for (size_t i = 0; i < count; i++) {
+		messages.push_back("Datagram #" + std::to_string(i));
+	}
+	for (const std::string& m : messages) {
+		out.push_back({ (const uint8_t*)m.data(), m.size() });
+	}
+	sockaddr_storage to = sockB.localAddress();
+	std::vector<sockaddr_storage> peers(count, to);
+	std::vector<socklen_t> peerLengths(count, sockB.localAddress().size());
+
+	//Sent from another thread, since the receiver's queue may not hold every datagram (e.g. unix sockets)
+	log << "Sending " << count << " datagrams" << std::endl;
+	std::thread sender([&]() -> void{
+		sockA.sendMany(out.data(), peers.data(), peerLengths.data(), count);
+	});
+
+	std::vector<std::vector<uint8_t>> storage(count, std::vector<uint8_t>(64));
+	std::vector<sks::mutableBuffer> in;
+	for (std::vector<uint8_t>& b : storage) {
+		in.push_back({ b.data(), b.size() });
+	}
+	std::vector<size_t> lengths(count);
+	std::vector<sockaddr_storage> from(count);
+	std::vector<socklen_t> fromLengths(count);
+	size_t received = 0;
+	while (received < count) {
+		size_t n = sockB.receiveMany(in.data() + received, lengths.data() + received, from.data() + received, fromLengths.data() + received, count - received, std::chrono::milliseconds(1000));
+		assertGreaterThan(n, 0, "Timed out waiting for datagrams");
+		received += n;
+	}
+	sender.join();
+	log << "Received " << received << " datagrams" << std::endl;
+
+	for (size_t i = 0; i < count; i++) {
+		std::string m(storage[i].begin(), storage[i].begin() + lengths[i]);
+		assertEqual(m, messages[i], "Received datagram differs from sent datagram");
+		assertEqual(sks::address(from[i], fromLengths[i]), sockA.localAddress(), "Datagram received from wrong address");
+	}
+	assertEqual(sockB.receiveMany(in.data(), lengths.data(), nullptr, nullptr, count, std::chrono::milliseconds(0)), 0, "Received datagrams which were never sent");
+}
+
+void datagramsCanBeSegmented(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::dgram);
+
+	auto sockets = getRelatedSockets(log, d, sks::dgram);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	const uint16_t segmentSize = 100;
+	std::vector<uint8_t> data(segmentSize * 4 + 20); //Last segment is short
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = i;
+	}
+	std::vector<uint8_t> buffer(0x10000);
+	uint16_t receivedSegmentSize = 0;
+
+	//Without receive coalescing, every segment arrives as its own datagram
+	log << "Sending segmented data" << std::endl;
+	sockA.sendSegmented(data.data(), data.size(), segmentSize, sockB.localAddress());
+	std::vector<uint8_t> received;
+	while (received.size() < data.size()) {
+		assertTrue(sockB.readReady(std::chrono::milliseconds(100)), "Timed out waiting for segments");
+		size_t n = sockB.receiveCoalesced(buffer.data(), buffer.size(), receivedSegmentSize);
+		assertTrue(n <= segmentSize, "Segment is larger than the segment size");
+		assertEqual(receivedSegmentSize, n, "Uncoalesced datagram reported the wrong segment size");
+		received.insert(received.end(), buffer.begin(), buffer.begin() + n);
+	}
+	assertTrue(received == data, "Received segments differ from sent data");
+
+	//With receive coalescing, segments may arrive together
+	if (d != sks::IPv4 && d != sks::IPv6) {
+		assert(btf::ignore, "Receive offload only applies to UDP");
+	}
+	try {
+		sockB.receiveCoalescing(true);
+	} catch (const std::exception& e) {
+		assert(btf::ignore, "System does not support UDP receive offload");
+	}
+	assertTrue(sockB.receiveCoalescing(), "Receive coalescing was not enabled");
+	log << "Sending segmented data with receive coalescing enabled" << std::endl;
+	sockA.sendSegmented(data.data(), data.size(), segmentSize, sockB.localAddress());
+	received.clear();
+	while (received.size() < data.size()) {
+		assertTrue(sockB.readReady(std::chrono::milliseconds(100)), "Timed out waiting for segments");
+		sks::address from;
+		size_t n = sockB.receiveCoalesced(from, buffer.data(), buffer.size(), receivedSegmentSize);
+		log << "Received " << n << " bytes in segments of " << receivedSegmentSize << std::endl;
+		assertEqual(from, sockA.localAddress(), "Socket received data from wrong address");
+		received.insert(received.end(), buffer.begin(), buffer.begin() + n);
+	}
+	assertTrue(received == data, "Received coalesced segments differ from sent data");
+}
+
+void zeroCopySendsAreReleased(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+
+	auto sockets = getRelatedSockets(log, d, sks::stream);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	std::vector<uint32_t> released;
+	sks::zeroCopySender sender(sockA, [&](uint32_t token, bool copied) -> void{
+		released.push_back(token);
+	});
+	log << "Zero-copy " << (sender.usingZeroCopy() ? "enabled" : "unavailable") << std::endl;
+
+	std::vector<uint8_t> data(0x100000); //1MiB
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = i * 7;
+	}
+	std::vector<uint8_t> received;
+	std::thread receiver([&]() -> void{
+		while (received.size() < data.size() * 2) {
+			std::vector<uint8_t> part = sockB.receive();
+			if (part.empty()) {
+				break;
+			}
+			received.insert(received.end(), part.begin(), part.end());
+		}
+	});
+	uint32_t first = sender.send(data.data(), data.size());
+	uint32_t second = sender.send(data.data(), data.size());
+	receiver.join();
+	assertEqual(received.size(), data.size() * 2, "Received the wrong number of bytes");
+	assertTrue(std::equal(data.begin(), data.end(), received.begin()), "Received data differs from sent data");
+
+	//Data was received, so every send must complete
+	for (size_t i = 0; i < 100 && sender.pending() > 0; i++) {
+		sender.drainCompletions(std::chrono::milliseconds(10));
+	}
+	assertEqual(sender.pending(), 0, "Sends were never released");
+	assertEqual(released.size(), 2, "Release callback was not called once per send");
+	assertEqual(released[0], first, "Sends were released out of order");
+	assertEqual(released[1], second, "Sends were released out of order");
+}
+
+void filesCanBeSent(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+
+	auto sockets = getRelatedSockets(log, d, sks::stream);
+	sks::socket& sockA = sockets.first;
+	sks::socket& sockB = sockets.second;
+
+	std::string path = "testing.sendFile." + str(d);
+	std::vector<uint8_t> contents(0x40000);
+	for (size_t i = 0; i < contents.size(); i++) {
+		contents[i] = i * 13;
+	}
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*)contents.data(), contents.size());
+	}
+
+	std::vector<uint8_t> received;
+
+	//Whole file by path, received while sending since it exceeds the socket buffers
+	log << "Sending file by path" << std::endl;
+	std::thread receiver([&]() -> void{
+		while (received.size() < contents.size()) {
+			std::vector<uint8_t> part = sockB.receive();
+			if (part.empty()) {
+				break;
+			}
+			received.insert(received.end(), part.begin(), part.end());
+		}
+	});
+	sockA.sendFile(path);
+	receiver.join();
+	assertTrue(received == contents, "Received file differs from sent file");
+
+	//Part of the file without blocking
+	log << "Sending part of file without blocking" << std::endl;
+	FILE* file = fopen(path.c_str(), "rb");
+	received.clear();
+	uint64_t offset = 100;
+	size_t length = 0x20000;
+	while (offset < 100 + length) {
+		size_t sent = sockA.trySendFile(fileno(file), offset, 100 + length - offset);
+		if (sent == 0) {
+			std::vector<uint8_t> part = sockB.receive(); //Make room
+			received.insert(received.end(), part.begin(), part.end());
+		}
+	}
+	int error = 0;
+	try {
+		offset = contents.size();
+		sockA.trySendFile(fileno(file), offset, 1);
+	} catch (const std::system_error& e) {
+		error = e.code().value();
+	}
+	assertEqual(error, ENODATA, "End of file was not reported");
+	fclose(file);
+	std::remove(path.c_str());
+	while (received.size() < length) {
+		std::vector<uint8_t> part = sockB.receive();
+		assertGreaterThan(part.size(), 0, "Connection closed before the file was received");
+		received.insert(received.end(), part.begin(), part.end());
+	}
+	assertTrue(std::equal(received.begin(), received.end(), contents.begin() + 100), "Received part of file differs from sent part");
+}
+
+void relayForwardsBothDirections(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+
+	//client <-> (proxyIn <-relay-> proxyOut) <-> server
+	auto clientSide = getRelatedSockets(log, d, sks::stream);
+	sks::socket& client = clientSide.first;
+	sks::socket& proxyIn = clientSide.second;
+	if (d == sks::unix) {
+		std::remove(bindableAddress(d).name().c_str()); //First listener's socket file, so the second pair can bind
+	}
+	auto serverSide = getRelatedSockets(log, d, sks::stream);
+	sks::socket& proxyOut = serverSide.first;
+	sks::socket& server = serverSide.second;
+
+	sks::relay r(proxyIn, proxyOut, 0x1000); //Smaller than the request, so it is split across transfers
+	std::thread relayThread([&]() -> void{
+		r.run();
+	});
+
+	auto receiveUntilClosed = [](sks::socket& s) -> std::vector<uint8_t> {
+		std::vector<uint8_t> received;
+		while (true) {
+			std::vector<uint8_t> part = s.receive();
+			if (part.empty()) {
+				return received;
+			}
+			received.insert(received.end(), part.begin(), part.end());
+		}
+	};
+
+	std::vector<uint8_t> request(0x8000, 'Q');
+	std::vector<uint8_t> response = {'O', 'K'};
+	log << "Sending request through relay" << std::endl;
+	std::thread clientThread([&]() -> void{
+		client.send(request);
+		::shutdown(client.socketFD(), SHUT_WR); //Half-close, the response must still arrive
+	});
+	assertTrue(receiveUntilClosed(server) == request, "Server received the wrong request");
+	clientThread.join();
+	log << "Sending response through relay" << std::endl;
+	server.send(response);
+	::shutdown(server.socketFD(), SHUT_WR);
+	assertTrue(receiveUntilClosed(client) == response, "Client received the wrong response");
+
+	relayThread.join();
+	assertTrue(r.finished(), "Relay did not finish after both sides closed");
+	assertEqual(r.bytesAToB(), request.size(), "Relay counted the wrong number of request bytes");
+	assertEqual(r.bytesBToA(), response.size(), "Relay counted the wrong number of response bytes");
+}
+
+void addressesFormatWithoutAllocating(std::ostream& log, const sks::domain& d) {
+	sks::address addr;
+	std::string expected;
+	switch (d) {
+		case sks::IPv4:
+			addr = sks::address(sks::IPv4Address("10.0.255.85:255"));
+			expected = "10.0.255.85:255";
+			break;
+		case sks::IPv6:
+			addr = sks::address(sks::IPv6Address("[a:ff00:aaaa::ff:8d5]:16000"));
+			expected = "[a:ff00:aaaa::ff:8d5]:16000";
+			break;
+		case sks::unix:
+			addr = sks::address(sks::unixAddress("/tmp/formatted.unix"));
+			expected = "/tmp/formatted.unix";
+			break;
+		default:
+			assert(btf::ignore, "Domain not covered by this test");
+	}
+
+	char buf[sks::address::maxNameLength];
+	size_t len = addr.formatTo(buf, sizeof(buf));
+	log << "Formatted as " << buf << std::endl;
+	assertEqual(len, expected.size(), "formatTo(...) reported the wrong length");
+	assertEqual(std::string(buf), expected, "formatTo(...) wrote the wrong name");
+	assertEqual(addr.name(), expected, "name() differs from formatTo(...)");
+
+	//Truncated output is still null-terminated, and reports the full length
+	char small[6];
+	len = addr.formatTo(small, sizeof(small));
+	assertEqual(len, expected.size(), "formatTo(...) did not report the full length when truncating");
+	assertEqual(std::string(small), expected.substr(0, sizeof(small) - 1), "formatTo(...) truncated incorrectly");
+}
+
+void numericLiteralsParseWithoutResolving(std::ostream& log) {
+	struct literal {
+		std::string text;
+		sks::domain d;
+		std::string name; //Expected canonical name
+	};
+	std::vector<literal> literals = {
+		{"127.0.0.1", sks::IPv4, "127.0.0.1:0"},
+		{"10.0.255.85:255", sks::IPv4, "10.0.255.85:255"},
+		{"::1", sks::IPv6, "[::1]:0"},
+		{"[::]:8080", sks::IPv6, "[::]:8080"},
+		{"[a:ff00:aaaa::ff:8d5]:16000", sks::IPv6, "[a:ff00:aaaa::ff:8d5]:16000"},
+		{"1:2:3:4:5:6:7:8", sks::IPv6, "[1:2:3:4:5:6:7:8]:0"},
+		{"[::ffff:10.1.2.3]:53", sks::IPv6, "[::ffff:10.1.2.3]:53"},
+		{"fe80::", sks::IPv6, "[fe80::]:0"},
+	};
+	for (const literal& l : literals) {
+		log << "Parsing " << l.text << std::endl;
+		sks::address addr(l.text);
+		assertEqual(addr.addressDomain(), l.d, "Literal parsed as the wrong domain");
+		assertEqual(addr.name(), l.name, "Literal parsed to the wrong address");
+	}
+	assertEqual(sks::IPv4Address("192.168.1.20:443").name(), "192.168.1.20:443", "IPv4Address parsed the wrong address");
+	assertEqual(sks::IPv6Address("[2001:db8::1]:443").name(), "[2001:db8::1]:443", "IPv6Address parsed the wrong address");
+
+	//Hostnames still go through the resolver
+	log << "Resolving localhost" << std::endl;
+	assertEqual(sks::IPv4Address("localhost:80").name(), "127.0.0.1:80", "Hostname was not resolved");
+
+	//Malformed literals are not accepted
+	for (const std::string& bad : {"1.2.3.256", "1.2.3.4.5", "[1::2::3]:80", "[1:2:3:4:5:6:7:8::]:80"}) {
+		log << "Rejecting " << bad << std::endl;
+		bool threw = false;
+		try {
+			sks::address addr(bad);
+		} catch (...) {
+			threw = true;
+		}
+		assertTrue(threw, "Malformed literal was accepted");
+	}
+	//Without brackets, a domain-less address would go on to read this as IPv4 host "1" and port "2"
+	bool threw = false;
+	try {
+		sks::address addr("1:2:3:4:5:6:7:8::", sks::IPv6);
+	} catch (...) {
+		threw = true;
+	}
+	assertTrue(threw, "\"::\" after eight groups was accepted");
+}
+
+void resolverCachesAndCoalescesLookups(std::ostream& log) {
+	std::atomic<int> lookups(0);
+	sks::resolver::lookupFunction stub = [&](const std::string& host, sks::domain d) -> std::vector<sks::address>{
+		lookups++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50)); //Slow enough for concurrent lookups to overlap
+		if (host == "service.test") {
+			return {sks::address("10.1.2.3")};
+		}
+		return {};
+	};
+	sks::resolver r(stub, std::chrono::milliseconds(200), std::chrono::milliseconds(100));
+
+	log << "Resolving concurrently" << std::endl;
+	std::vector<std::thread> threads;
+	std::vector<sks::address> results(8);
+	for (size_t i = 0; i < results.size(); i++) {
+		threads.emplace_back([&, i]() -> void{
+			results[i] = r.resolve("service.test:8080");
+		});
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	assertEqual(lookups.load(), 1, "Concurrent lookups were not coalesced");
+	for (const sks::address& a : results) {
+		assertEqual(a.name(), "10.1.2.3:8080", "Resolved to the wrong address");
+	}
+
+	log << "Resolving from cache" << std::endl;
+	assertEqual(sks::address("service.test:443", r).name(), "10.1.2.3:443", "address(...) did not use the resolver");
+	assertEqual(lookups.load(), 1, "Cached result was not used");
+	assertEqual(r.resolve("127.0.0.1:80").name(), "127.0.0.1:80", "Numeric address was not parsed");
+	assertEqual(lookups.load(), 1, "Numeric address was looked up");
+
+	log << "Caching failures" << std::endl;
+	for (size_t i = 0; i < 2; i++) {
+		bool threw = false;
+		try {
+			r.resolve("missing.test:80");
+		} catch (const std::exception& e) {
+			threw = true;
+		}
+		assertTrue(threw, "Unresolvable name did not throw");
+	}
+	assertEqual(lookups.load(), 2, "Failed lookup was not cached");
+
+	log << "Waiting for entries to expire" << std::endl;
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	r.resolve("service.test");
+	assertEqual(lookups.load(), 3, "Expired result was not looked up again");
+	try {
+		r.resolve("missing.test");
+	} catch (const std::exception& e) {}
+	assertEqual(lookups.load(), 4, "Expired failure was not looked up again");
+
+	log << "Bounding the cache" << std::endl;
+	sks::resolver bounded(stub, std::chrono::seconds(60), std::chrono::seconds(60), 1, 1, 4);
+	for (size_t i = 0; i < 8; i++) {
+		try {
+			bounded.resolve("name" + std::to_string(i) + ".test");
+		} catch (const std::exception& e) {}
+	}
+	assertEqual(bounded.size(), 4, "Cache grew past its bound");
+}
+
+void resolverResolvesAsynchronously(std::ostream& log) {
+	sks::resolver::lookupFunction stub = [&](const std::string& host, sks::domain d) -> std::vector<sks::address>{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		if (host == "multi.test") {
+			return {sks::address("10.0.0.1"), sks::address("::2")};
+		}
+		throw std::runtime_error("Unknown host " + host);
+	};
+	sks::resolver r(stub);
+
+	log << "Starting lookups" << std::endl;
+	auto start = std::chrono::steady_clock::now();
+	std::future<std::vector<sks::address>> all = r.resolveAllAsync("multi.test:53");
+	std::mutex lock;
+	std::condition_variable done;
+	bool called = false;
+	std::exception_ptr failure;
+	r.resolveAllAsync("missing.test", [&](std::vector<sks::address> addresses, std::exception_ptr error) -> void{
+		std::lock_guard<std::mutex> guard(lock);
+		failure = error;
+		called = true;
+		done.notify_all();
+	});
+	assertTrue(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50), "Asynchronous lookups blocked the caller");
+
+	std::vector<sks::address> addresses = all.get();
+	assertEqual(addresses.size(), 2, "Not every address was returned");
+	assertEqual(addresses[0].name(), "10.0.0.1:53", "First address is wrong");
+	assertEqual(addresses[1].name(), "[::2]:53", "Second address is wrong");
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait_for(guard, std::chrono::seconds(5), [&]() -> bool{ return called; });
+	}
+	assertTrue(called, "Callback was not called");
+	assertTrue(failure != nullptr, "Failed lookup did not report an error");
+
+	//Cached results complete right away
+	log << "Resolving from cache" << std::endl;
+	start = std::chrono::steady_clock::now();
+	std::future<std::vector<sks::address>> again = r.resolveAllAsync("multi.test");
+	assertTrue(again.wait_for(std::chrono::seconds(0)) == std::future_status::ready, "Cached lookup did not complete immediately");
+	assertEqual(again.get().size(), 2, "Cached lookup lost addresses");
+}
+
+void pooledReceivesReuseBuffers(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	assertSystemSupports(log, d, t);
+	std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, t);
+	sks::socket& a = pair.first;
+	sks::socket& b = pair.second;
+	sks::bufferPool pool(false, 1);
+
+	std::vector<uint8_t> message = {'p', 'o', 'o', 'l', 'e', 'd'};
+	const uint8_t* firstBuffer = nullptr;
+	for (size_t i = 0; i < 4; i++) {
+		if (t == sks::dgram) {
+			a.send(message, b.localAddress());
+		} else {
+			a.send(message);
+		}
+		sks::pooledBuffer received = b.receive(pool, 0x10000);
+		assertEqual(received.size(), message.size(), "Received the wrong number of bytes");
+		assertTrue(received.toVector() == message, "Received the wrong data");
+		assertGreaterThan(received.capacity(), 0xFFFF, "Buffer is smaller than requested");
+		if (i == 0) {
+			firstBuffer = received.data();
+		} else {
+			assertEqual((const void*)received.data(), (const void*)firstBuffer, "Released buffer was not reused");
+		}
+	}
+	size_t slabBytes = pool.slabBytes();
+	log << "Pool holds " << slabBytes << " bytes of slabs" << std::endl;
+
+	//Moving keeps ownership with a single handle
+	sks::pooledBuffer first = pool.acquire(0x10000);
+	sks::pooledBuffer second = std::move(first);
+	assertTrue(first.data() == nullptr, "Moved-from buffer still owns memory");
+	assertEqual(second.size(), 0x10000, "Moved buffer has the wrong size");
+	second.release();
+	assertEqual(pool.slabBytes(), slabBytes, "Buffer of a used size class needed a new slab");
+}
+
+void streamReaderParsesInPlace(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+	for (bool mirror : {false, true}) {
+		std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, sks::stream);
+		sks::socket& a = pair.first;
+		sks::socket& b = pair.second;
+		sks::streamReader reader(b, 64, mirror);
+		log << "Reader has " << reader.capacity() << " bytes, mirrored: " << reader.mirrored() << std::endl;
+
+		//Length-prefixed frames, enough to wrap around the ring several times
+		std::vector<std::string> frames;
+		std::vector<uint8_t> data;
+		for (size_t i = 0; i < 200; i++) {
+			std::string frame(1 + i % 40, 'a' + i % 26);
+			frames.push_back(frame);
+			data.push_back(frame.size());
+			data.insert(data.end(), frame.begin(), frame.end());
+		}
+		std::thread sender([&]() -> void{
+			a.send(data);
+			::shutdown(a.socketFD(), SHUT_WR);
+		});
+
+		size_t parsed = 0;
+		while (reader.fillUntil(1)) {
+			size_t length = reader.peek().data[0];
+			if (!reader.fillUntil(1 + length)) {
+				break;
+			}
+			sks::constBuffer segments[2];
+			size_t count = reader.peek(segments);
+			if (reader.mirrored()) {
+				assertEqual(count, 1, "Mirrored reader returned wrapped data");
+			}
+			std::string frame;
+			for (size_t i = 0; i < count; i++) {
+				frame.append((const char*)segments[i].data, segments[i].size);
+			}
+			frame = frame.substr(1, length);
+			assertTrue(parsed < frames.size(), "Parsed too many frames");
+			assertEqual(frame, frames[parsed], "Parsed the wrong frame");
+			reader.consume(1 + length);
+			parsed++;
+		}
+		sender.join();
+		assertTrue(reader.ended(), "Reader did not see the end of the stream");
+		assertEqual(parsed, frames.size(), "Did not parse every frame");
+		assertEqual(reader.available(), 0, "Reader has leftover bytes");
+	}
+}
+
+void nonBlockingTransfersReportWouldBlock(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	assertSystemSupports(log, d, t);
+	std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, t);
+	sks::socket& a = pair.first;
+	sks::socket& b = pair.second;
+	a.nonBlocking(true);
+	b.nonBlocking(true);
+	assertTrue(a.nonBlocking(), "Socket did not enter non-blocking mode");
+
+	uint8_t buf[0x1000];
+	log << "Receiving with nothing queued" << std::endl;
+	sks::ioResult r = b.tryReceive(buf, sizeof(buf));
+	assertEqual(r.status, sks::ioWouldBlock, "Empty receive did not report would-block");
+
+	std::vector<uint8_t> message = {'t', 'r', 'y'};
+	if (t == sks::dgram) {
+		r = a.trySend(message.data(), message.size(), b.localAddress());
+	} else {
+		r = a.trySend(message.data(), message.size());
+	}
+	assertEqual(r.status, sks::ioDone, "Send did not complete");
+	assertEqual(r.bytes, message.size(), "Send was partial");
+	assertTrue(b.readReady(std::chrono::milliseconds(1000)), "Sent data never arrived");
+	r = b.tryReceive(buf, sizeof(buf));
+	assertEqual(r.status, sks::ioDone, "Receive did not complete");
+	assertTrue(std::vector<uint8_t>(buf, buf + r.bytes) == message, "Received the wrong data");
+
+	if (t == sks::stream) {
+		//Fill the connection until the kernel pushes back, then drain it all
+		log << "Filling send buffer" << std::endl;
+		std::vector<uint8_t> chunk(0x10000, 'x');
+		size_t sent = 0;
+		while (true) {
+			r = a.trySend(chunk.data(), chunk.size());
+			if (r.status == sks::ioWouldBlock) {
+				break;
+			}
+			sent += r.bytes;
+		}
+		log << "Sent " << sent << " bytes before blocking" << std::endl;
+		size_t received = 0;
+		while (received < sent) {
+			r = b.tryReceive(buf, sizeof(buf));
+			if (r.status == sks::ioWouldBlock) {
+				b.readReady(std::chrono::milliseconds(100));
+				continue;
+			}
+			assertEqual(r.status, sks::ioDone, "Connection closed while draining");
+			received += r.bytes;
+		}
+		assertEqual(received, sent, "Did not receive everything sent");
+
+		//Closed connections are reported rather than thrown
+		pair.first = sks::socket(d, t);
+		assertTrue(b.readReady(std::chrono::milliseconds(1000)), "Close was never seen");
+		r = b.tryReceive(buf, sizeof(buf));
+		assertEqual(r.status, sks::ioClosed, "Closed connection was not reported");
+
+		//Accept without anything pending
+		sks::socket listener(d, t);
+		listener.bind(bindableAddress(d, 1));
+		listener.listen();
+		assertTrue(listener.tryAccept() == nullptr, "Accept returned a connection that does not exist");
+		sks::socket client(d, t);
+		client.connect(listener.localAddress());
+		assertTrue(listener.readReady(std::chrono::milliseconds(1000)), "Connection never became acceptable");
+		std::unique_ptr<sks::socket> accepted = listener.tryAccept();
+		assertTrue(accepted != nullptr, "Pending connection was not accepted");
+		assertTrue(!listener.nonBlocking(), "tryAccept() left the listener non-blocking");
+	}
+}
+
+void addressesConstructConcurrently(std::ostream& log) {
+	//Construction, copies and socket lifetimes share no library state, so threads can churn through them freely
+	const size_t threadCount = 8;
+	const size_t iterations = 2000;
+	std::atomic<size_t> mismatches(0);
+	std::vector<std::thread> threads;
+	log << "Constructing addresses and sockets from " << threadCount << " threads" << std::endl;
+	for (size_t i = 0; i < threadCount; i++) {
+		threads.emplace_back([&, i]() {
+			std::string text = "10.0.0." + std::to_string(i) + ":" + std::to_string(1000 + i);
+			for (size_t j = 0; j < iterations; j++) {
+				sks::address a(text);
+				sks::address copy = a;
+				sks::address moved = std::move(copy);
+				if (moved.name() != text) {
+					mismatches++;
+				}
+				if (j % 100 == 0) {
+					sks::socket s(sks::IPv4, sks::dgram);
+				}
+			}
+		});
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	assertEqual(mismatches.load(), (size_t)0, "Addresses built concurrently were corrupted");
+}
+
+void closePoliciesEndConnections(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+	uint8_t buf[256];
+
+	//Half-close, the other direction keeps working
+	{
+		log << "Shutting down one direction" << std::endl;
+		std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, sks::stream);
+		pair.first.shutdownWrite();
+		assertTrue(pair.second.readReady(std::chrono::milliseconds(1000)), "Half-close was not seen by the peer");
+		assertEqual(pair.second.receive(buf, sizeof(buf)), (size_t)0, "Peer did not read the end of the stream");
+		std::vector<uint8_t> reply = {'o', 'k'};
+		pair.second.send(reply);
+		assertTrue(pair.first.readReady(std::chrono::milliseconds(1000)), "Reply never arrived after half-close");
+		assertEqual(pair.first.receive(buf, sizeof(buf)), reply.size(), "Reply was cut short after half-close");
+	}
+
+	//Draining waits for the peer to finish, but no longer than the timeout
+	{
+		log << "Draining on close" << std::endl;
+		std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, sks::stream);
+		std::unique_ptr<sks::socket> closing(new sks::socket(std::move(pair.first)));
+		assertEqual(closing->closePolicy(), sks::closeShutdown, "Sockets no longer shut down on close by default");
+		closing->closePolicy(sks::closeDrain, std::chrono::milliseconds(5000));
+		assertEqual(closing->closePolicy(), sks::closeDrain, "Close policy was not kept");
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::thread closer([&]() {
+			closing.reset();
+		});
+		assertTrue(pair.second.readReady(std::chrono::milliseconds(1000)), "Draining close did not half-close");
+		assertEqual(pair.second.receive(buf, sizeof(buf)), (size_t)0, "Peer did not read the end of the stream");
+		std::vector<uint8_t> late = {'l', 'a', 't', 'e'};
+		pair.second.send(late); //Discarded by the drain
+		pair.second = sks::socket(d, sks::stream); //Close the peer's end
+		closer.join();
+		std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - start;
+		log << "Drained in " << std::chrono::duration_cast<std::chrono::milliseconds>(took).count() << "ms" << std::endl;
+		assertTrue(took < std::chrono::milliseconds(2500), "Drain waited for the timeout after the peer closed");
+	}
+
+	if (d == sks::IPv4 || d == sks::IPv6) {
+		//Abortive closes reset the connection
+		log << "Resetting on close" << std::endl;
+		std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, sks::stream);
+		pair.first.closePolicy(sks::closeAbortive);
+		pair.first = sks::socket(d, sks::stream);
+		assertTrue(pair.second.readReady(std::chrono::milliseconds(1000)), "Reset was not seen by the peer");
+		int error = 0;
+		try {
+			pair.second.receive(buf, sizeof(buf));
+		} catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+		assertEqual(error, ECONNRESET, "Abortive close did not reset the connection");
+	}
+
+	if (d == sks::unix) {
+		//Only the socket bound to the path removes it
+		log << "Removing the bound path" << std::endl;
+		sks::address path = bindableAddress(d);
+		std::unique_ptr<sks::socket> listener(new sks::socket(d, sks::stream));
+		listener->bind(path);
+		listener->listen();
+		std::string pathName = ((sks::unixAddress)path).name();
+		{
+			sks::socket client(d, sks::stream);
+			client.connect(path);
+			sks::socket accepted = listener->accept();
+		}
+		assertTrue(std::filesystem::exists(pathName), "Accepted socket removed the listener's path");
+		listener.reset();
+		assertTrue(!std::filesystem::exists(pathName), "Listener did not remove its path");
+	}
+}
+
+void acceptManyDrainsTheBacklog(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+	sks::socket listener(d, sks::stream);
+	listener.bind(bindableAddress(d));
+	listener.listen();
+	sks::address listenerAddress = listener.localAddress();
+
+	log << "Accepting with nothing pending" << std::endl;
+	assertTrue(listener.acceptMany().empty(), "Accepted a connection which was never made");
+
+	const size_t clientCount = 5;
+	std::vector<sks::socket> clients;
+	for (size_t i = 0; i < clientCount; i++) {
+		clients.emplace_back(d, sks::stream);
+		clients.back().connect(listenerAddress);
+	}
+
+	log << "Accepting " << clientCount << " connections" << std::endl;
+	std::vector<sks::socket> accepted = listener.acceptMany(2);
+	assertTrue(accepted.size() <= 2, "Accepted more than maxCount connections");
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (accepted.size() < clientCount && std::chrono::steady_clock::now() < deadline) {
+		listener.readReady(std::chrono::milliseconds(100));
+		for (sks::socket& peer : listener.acceptMany()) {
+			accepted.push_back(std::move(peer));
+		}
+	}
+	assertEqual(accepted.size(), clientCount, "Not every pending connection was accepted");
+
+	//Peers start non-blocking, and report the client's address
+	for (size_t i = 0; i < clientCount; i++) {
+		assertTrue(accepted[i].nonBlocking(), "Accepted socket is not in non-blocking mode");
+		sks::address peer = accepted[i].connectedAddress();
+		bool matched = false;
+		for (sks::socket& c : clients) {
+			if (c.localAddress().name() == peer.name()) {
+				matched = true;
+			}
+		}
+		assertTrue(matched, "Accepted socket reports the wrong peer");
+	}
+	std::vector<uint8_t> message = {'h', 'i'};
+	clients[0].send(message);
+	size_t received = 0;
+	for (sks::socket& peer : accepted) {
+		if (peer.readReady(std::chrono::milliseconds(200))) {
+			received += peer.receive().size();
+		}
+	}
+	assertEqual(received, message.size(), "Data did not arrive on the accepted socket");
+
+	//Blocking peers on request
+	sks::socket late(d, sks::stream);
+	late.connect(listenerAddress);
+	assertTrue(listener.readReady(std::chrono::milliseconds(1000)), "Late connection never arrived");
+	std::vector<sks::socket> blocking = listener.acceptMany(1, false);
+	assertEqual(blocking.size(), (size_t)1, "Late connection was not accepted");
+	assertTrue(!blocking[0].nonBlocking(), "Peer is non-blocking when asked not to be");
+}
+
+void listenerGroupSpreadsConnections(std::ostream& log, const sks::domain& d, const sks::type& t) {
+	if ((d != sks::IPv4 && d != sks::IPv6) || (t != sks::stream && t != sks::dgram)) {
+		assert(btf::ignore, "listenerGroup is tested over TCP and UDP only");
+	}
+	assertSystemSupports(log, d, t);
+	for (bool steer : {false, true}) {
+		log << (steer ? "Steered" : "Hashed") << " group" << std::endl;
+		sks::listenerGroup group(bindableAddress(d), t, 4, steer);
+		size_t cpus = std::thread::hardware_concurrency();
+		size_t expected = steer && cpus > 0 && cpus < 4 ? cpus : 4; //Steered groups have at most one member per CPU
+		assertEqual(group.size(), expected, "Wrong number of members");
+		assertEqual(group.steered(), steer, "Steering was not attached");
+		for (sks::socket& member : group) {
+			assertEqual(member.localAddress().name(), group.localAddress().name(), "Members are bound to different addresses");
+		}
+
+		//Each client has its own source port, so the kernel may pick any member for each
+		const size_t clientCount = 16;
+		std::vector<sks::socket> clients;
+		std::vector<uint8_t> message = {'g', 'r', 'o', 'u', 'p'};
+		for (size_t i = 0; i < clientCount; i++) {
+			clients.emplace_back(d, t);
+			if (t == sks::stream) {
+				clients.back().connect(group.localAddress());
+			} else {
+				clients.back().send(message, group.localAddress());
+			}
+		}
+		size_t arrived = 0;
+		std::vector<size_t> perMember(group.size(), 0);
+		std::vector<sks::socket> accepted;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+		while (arrived < clientCount && std::chrono::steady_clock::now() < deadline) {
+			for (size_t i = 0; i < group.size(); i++) {
+				sks::socket& member = group[i];
+				if (!member.readReady(std::chrono::milliseconds(10))) {
+					continue;
+				}
+				if (t == sks::stream) {
+					for (sks::socket& peer : member.acceptMany()) {
+						accepted.push_back(std::move(peer));
+						perMember[i]++;
+						arrived++;
+					}
+				} else {
+					assertEqual(member.receive().size(), message.size(), "Datagram was cut short");
+					perMember[i]++;
+					arrived++;
+				}
+			}
+		}
+		assertEqual(arrived, clientCount, "Not everything sent to the group arrived");
+		if (!steer) {
+			//Hashing 16 source ports onto one of 4 members has a one in a billion chance
+			size_t used = 0;
+			for (size_t n : perMember) {
+				used += n > 0 ? 1 : 0;
+			}
+			assertGreaterThan(used, 1, "Hashed group did not spread traffic across members");
+		}
+	}
+}
+
+void serverRuntimeServesConnections(std::ostream& log, const sks::domain& d) {
+	if (d != sks::IPv4 && d != sks::IPv6) {
+		assert(btf::ignore, "serverRuntime is tested over TCP only");
+	}
+	assertSystemSupports(log, d, sks::stream);
+	std::atomic<size_t> opened(0);
+	std::atomic<size_t> closed(0);
+	sks::serverHandlers handlers;
+	handlers.onOpen = [&](sks::connection& c) {
+		opened++;
+	};
+	handlers.onData = [&](sks::connection& c, const uint8_t* data, size_t len) {
+		c.send(data, len); //Echo
+	};
+	handlers.onClose = [&](sks::connection& c) {
+		closed++;
+	};
+	sks::serverRuntime runtime(bindableAddress(d), handlers, 2);
+	assertEqual(runtime.size(), (size_t)2, "Wrong number of workers");
+	runtime.start();
+
+	const size_t clientCount = 8;
+	std::vector<sks::socket> clients;
+	log << "Echoing through " << clientCount << " clients" << std::endl;
+	for (size_t i = 0; i < clientCount; i++) {
+		clients.emplace_back(d, sks::stream);
+		clients.back().connect(runtime.localAddress());
+	}
+	for (size_t i = 0; i < clientCount; i++) {
+		std::string message = "client " + std::to_string(i);
+		clients[i].send((const uint8_t*)message.data(), message.size());
+		std::string reply;
+		while (reply.size() < message.size() && clients[i].readReady(std::chrono::milliseconds(2000))) {
+			std::vector<uint8_t> bytes = clients[i].receive();
+			if (bytes.empty()) {
+				break;
+			}
+			reply.append(bytes.begin(), bytes.end());
+		}
+		assertEqual(reply, message, "Echo did not match");
+	}
+	assertEqual(opened.load(), clientCount, "Not every connection was opened");
+
+	//Tasks run on each worker's own thread, which owns its connections
+	log << "Counting connections on each worker" << std::endl;
+	std::atomic<size_t> counted(0);
+	std::atomic<size_t> workersVisited(0);
+	for (size_t w = 0; w < runtime.size(); w++) {
+		runtime.post(w, [](sks::serverWorker& worker) {
+			throw std::runtime_error("Failing task"); //Must not take the worker (or the tasks after it) down
+		});
+		runtime.post(w, [&](sks::serverWorker& worker) {
+			counted += worker.size();
+			workersVisited++;
+		});
+	}
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (workersVisited < runtime.size() && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	assertEqual(counted.load(), clientCount, "Workers do not own every connection");
+
+	log << "Closing half the clients" << std::endl;
+	clients.erase(clients.begin() + clientCount / 2, clients.end());
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (closed < clientCount / 2 && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	assertEqual(closed.load(), clientCount / 2, "Closed clients were not noticed");
+	runtime.stop();
+	runtime.wait();
+	assertEqual(closed.load(), clientCount, "Stopping did not close the remaining connections");
+}
+
+void connectionPoolReusesConnections(std::ostream& log, const sks::domain& d) {
+	if (d != sks::IPv4 && d != sks::IPv6) {
+		assert(btf::ignore, "connectionPool is tested over TCP only");
+	}
+	assertSystemSupports(log, d, sks::stream);
+	sks::serverHandlers handlers;
+	std::atomic<size_t> opened(0);
+	handlers.onOpen = [&](sks::connection& c) {
+		opened++;
+	};
+	handlers.onData = [&](sks::connection& c, const uint8_t* data, size_t len) {
+		c.send(data, len);
+	};
+	sks::serverRuntime server(bindableAddress(d), handlers, 1, false);
+	server.start();
+	sks::address to = server.localAddress();
+
+	sks::connectionPool::limits l;
+	l.maxIdle = 1;
+	l.maxTotal = 2;
+	sks::connectionPool pool(l);
+	auto roundTrip = [&](sks::pooledConnection& c) {
+		std::vector<uint8_t> message = {'p', 'o', 'o', 'l'};
+		c->send(message);
+		assertTrue(c->readReady(std::chrono::milliseconds(2000)), "Echo never arrived");
+		assertTrue(c->receive() == message, "Echo did not match");
+	};
+
+	log << "Reusing a returned connection" << std::endl;
+	sks::address firstLocal;
+	{
+		sks::pooledConnection c = pool.acquire(to);
+		assertTrue(!c.reused(), "First connection cannot be reused");
+		roundTrip(c);
+		firstLocal = c->localAddress();
+	}
+	assertEqual(pool.idle(), (size_t)1, "Connection was not returned");
+	{
+		sks::pooledConnection c = pool.acquire(to);
+		assertTrue(c.reused(), "Idle connection was not reused");
+		assertEqual(c->localAddress().name(), firstLocal.name(), "A different connection was handed out");
+		roundTrip(c);
+	}
+	assertEqual(opened.load(), (size_t)1, "Reuse still opened a new connection");
+
+	log << "Limiting connections per destination" << std::endl;
+	{
+		sks::pooledConnection a = pool.acquire(to);
+		sks::pooledConnection b = pool.acquire(to);
+		assertEqual(pool.leased(), (size_t)2, "Leases were not counted");
+		int error = 0;
+		try {
+			pool.acquire(to, std::chrono::milliseconds(50));
+		} catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+		assertEqual(error, ETIMEDOUT, "maxTotal was not enforced");
+	}
+	assertEqual(pool.idle(), (size_t)1, "maxIdle was not enforced");
+
+	log << "Skipping connections closed by the peer" << std::endl;
+	std::atomic<bool> closedByServer(false);
+	server.post(0, [&](sks::serverWorker& w) {
+		w.forEach([](sks::connection& c) {
+			c.close();
+		});
+		closedByServer = true;
+	});
+	while (!closedByServer) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50)); //FIN in flight
+	{
+		sks::pooledConnection c = pool.acquire(to);
+		assertTrue(!c.reused(), "A closed connection was handed out");
+		roundTrip(c);
+	}
+
+	log << "Reaping idle connections" << std::endl;
+	sks::connectionPool::limits shortLived;
+	shortLived.idleTimeout = std::chrono::milliseconds(10);
+	sks::connectionPool expiring(shortLived);
+	expiring.acquire(to);
+	assertEqual(expiring.idle(), (size_t)1, "Connection was not returned");
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	assertEqual(expiring.reap(), (size_t)1, "Timed out connection was not reaped");
+	assertEqual(expiring.idle(), (size_t)0, "Reaped connection is still idle");
+}
+
+void framedSocketsTransferMessages(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+	std::pair<sks::socket, sks::socket> pair = getRelatedSockets(log, d, sks::stream);
+	sks::socket& a = pair.first;
+	sks::socket& b = pair.second;
+
+	//Sizes include empty messages and ones larger than a varint's single byte
+	const size_t messageCount = 200;
+	std::vector<std::vector<uint8_t>> messages;
+	for (size_t i = 0; i < messageCount; i++) {
+		messages.emplace_back((i * 37) % 201, (uint8_t)i);
+	}
+	for (sks::lengthPrefix prefix : {sks::prefixVarint, sks::prefix16, sks::prefix32, sks::prefix64}) {
+		for (bool mirror : {true, false}) {
+			log << "Prefix " << (int)prefix << (mirror ? ", mirrored" : ", unmirrored") << std::endl;
+			//A small buffer, so messages wrap around its end
+			sks::framedSocket sender(a, prefix, 200, 512);
+			sks::framedSocket receiver(b, prefix, 200, 512, mirror);
+			std::thread sending([&]() {
+				std::vector<sks::constBuffer> batch;
+				for (size_t i = 0; i < messageCount / 2; i++) {
+					batch.push_back({ messages[i].data(), messages[i].size() });
+				}
+				sender.sendMany(batch.data(), batch.size());
+				for (size_t i = messageCount / 2; i < messageCount; i++) {
+					sender.send(messages[i]);
+				}
+			});
+			size_t received = 0;
+			size_t calls = 0;
+			bool matched = true;
+			while (received < messageCount) {
+				sks::constBuffer views[16];
+				size_t count = receiver.receiveMany(views, 16);
+				if (count == 0) {
+					break;
+				}
+				calls++;
+				for (size_t i = 0; i < count; i++) {
+					if (std::vector<uint8_t>(views[i].data, views[i].data + views[i].size) != messages[received + i]) {
+						matched = false;
+					}
+				}
+				received += count;
+			}
+			sending.join();
+			log << "Received " << received << " messages in " << calls << " calls" << std::endl;
+			assertEqual(received, messageCount, "Messages were lost");
+			assertTrue(matched, "A message was corrupted");
+			assertEqual(receiver.buffered(), (size_t)0, "Bytes were left over");
+		}
+	}
+
+	//Lengths beyond maxMessageSize are refused rather than buffered
+	log << "Receiving an oversized message" << std::endl;
+	sks::framedSocket sender(a, sks::prefix32, 1000);
+	sks::framedSocket receiver(b, sks::prefix32, 100);
+	sender.send(std::vector<uint8_t>(500, 'x'));
+	int error = 0;
+	try {
+		sks::constBuffer view;
+		receiver.receive(view);
+	} catch (const std::system_error& e) {
+		error = e.code().value();
+	}
+	assertEqual(error, EMSGSIZE, "Oversized message was accepted");
+
+	//Varint lengths must fit in 64 bits and use as few bytes as possible
+	const std::vector<std::vector<uint8_t>> malformed = {
+		{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02 }, //Bit 64, which would wrap
+		{ 0x85, 0x00 }, //5, with a needless zero group
+	};
+	for (const std::vector<uint8_t>& header : malformed) {
+		log << "Receiving a malformed " << header.size() << " byte varint" << std::endl;
+		std::pair<sks::socket, sks::socket> raw = getRelatedSockets(log, d, sks::stream);
+		raw.first.send(header);
+		sks::framedSocket varintReceiver(raw.second, sks::prefixVarint, 100);
+		error = 0;
+		try {
+			sks::constBuffer view;
+			varintReceiver.receive(view);
+		} catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+		assertEqual(error, EBADMSG, "Malformed varint was accepted");
+	}
+}
+
+#ifdef __SKS_HAS_COROUTINES__
+void coroutinesServeConnections(std::ostream& log, const sks::domain& d) {
+	assertSystemSupports(log, d, sks::stream);
+	sks::scheduler s;
+	sks::socket listener(d, sks::stream);
+	listener.bind(bindableAddress(d, 0));
+	listener.listen();
+	sks::address listenerAddress = listener.localAddress();
+
+	//Echo server handling each connection in its own task
+	std::vector<std::unique_ptr<sks::socket>> connections;
+	size_t clientCount = 20;
+	auto session = [](sks::socket& peer) -> sks::task<void>{
+		uint8_t buf[256];
+		while (true) {
+			size_t received = co_await peer.asyncReceive(buf, sizeof(buf));
+			if (received == 0) {
+				co_return;
+			}
+			co_await peer.asyncSend(buf, received);
+		}
+	};
+	auto server = [&]() -> sks::task<void>{
+		for (size_t i = 0; i < clientCount; i++) {
+			sks::socket peer = co_await listener.asyncAccept();
+			connections.emplace_back(new sks::socket(std::move(peer)));
+			sks::scheduler::current()->spawn(session(*connections.back()));
+		}
+	};
+	size_t echoed = 0;
+	auto client = [&](size_t index) -> sks::task<void>{
+		sks::socket c(d, sks::stream);
+		co_await c.asyncConnect(listenerAddress, std::chrono::milliseconds(5000));
+		std::string message = "client " + std::to_string(index);
+		co_await c.asyncSend((const uint8_t*)message.data(), message.size());
+		std::string reply;
+		uint8_t buf[256];
+		while (reply.size() < message.size()) {
+			size_t received = co_await c.asyncReceive(buf, sizeof(buf), 0, std::chrono::milliseconds(5000));
+			if (received == 0) {
+				break;
+			}
+			reply.append((const char*)buf, received);
+		}
+		if (reply == message) {
+			echoed++;
+		}
+	};
+	s.spawn(server());
+	for (size_t i = 0; i < clientCount; i++) {
+		s.spawn(client(i));
+	}
+	log << "Running " << s.size() << " tasks" << std::endl;
+	s.run();
+	assertEqual(echoed, clientCount, "Not every client got its echo");
+
+	//Timeouts and cancellation surface as exceptions inside the task
+	log << "Timing out and cancelling" << std::endl;
+	sks::socket idle(d, sks::stream);
+	idle.connect(listenerAddress);
+	sks::socket idlePeer = listener.accept();
+	int timeoutError = 0;
+	int cancelError = 0;
+	auto waitFor = [&](int& error, std::chrono::milliseconds timeout) -> sks::task<void>{
+		uint8_t buf[16];
+		try {
+			co_await idlePeer.asyncReceive(buf, sizeof(buf), 0, timeout);
+		} catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+	};
+	s.spawn(waitFor(timeoutError, std::chrono::milliseconds(50)));
+	s.run();
+	assertEqual(timeoutError, ETIMEDOUT, "Receive did not time out");
+	sks::scheduler::taskHandle h = s.spawn(waitFor(cancelError, std::chrono::milliseconds(-1)));
+	s.runOnce(std::chrono::milliseconds(0)); //Start it, so it is waiting
+	h.cancel();
+	s.run();
+	assertTrue(h.done(), "Cancelled task did not finish");
+	assertEqual(cancelError, ECANCELED, "Receive was not cancelled");
+}
+#endif